@@ -0,0 +1,127 @@
+
+/// Compares counting with normal and huge pages, for buffers in memory and for file mappings.
+/// usage: bench_huge_pages [SIZE_MB [FILE]]
+/// Without FILE a scratch file is created in $TMPDIR (or /tmp).
+
+#include "bitcnt.hpp"
+#include "on_exit.hpp"
+#include "sys.hpp"
+#include <algorithm> // for std::min
+#include <chrono>    // for std::chrono::steady_clock
+#include <cstdio>    // for printf
+#include <cstdlib>   // for getenv, strtoull
+#include <cstring>   // for memset
+#include <limits>    // for std::numeric_limits
+#include <string>    // for std::string
+
+using namespace bc;
+
+static constexpr int REPETITIONS = 5;
+
+/// Keeps the compiler from throwing away counts
+static volatile size_t sink;
+
+template<typename Fn>
+static double best_of(Fn &&fn) {
+  double best = std::numeric_limits<double>::infinity();
+
+  for (int i = 0; i < REPETITIONS; i++) {
+    const auto bgn = std::chrono::steady_clock::now();
+    fn();
+    const auto end = std::chrono::steady_clock::now();
+
+    best = std::min(best, std::chrono::duration<double>(end - bgn).count());
+  }
+
+  return best;
+}
+
+static void report(const char *what, size_t bytes, double secs) {
+  printf("%-32s %8.2f GB/s\n", what, bytes / secs / 1e9);
+}
+
+static void bench_buffer(const char *what, Bitcount_Buffer buffer, size_t size) {
+  /// fault everything in first, we only want to see TLB effects
+  memset(buffer.get(), 0x5a, size);
+
+  report(what, size, best_of([&]() { sink = bc::bitcount(size, buffer.get()).ones; }));
+}
+
+static void bench_mmap(const char *what, int fd, size_t size, unsigned flags) {
+  const double secs = best_of([&]() {
+    auto mmap = sys::mmap(fd, size, flags);
+    if (!mmap) {
+      fprintf(stderr, "error: could not mmap: %s\n", mmap.get_error().message().c_str());
+      exit(1);
+    }
+    auto unmapper = on_exit([&]() { sys::munmap(*mmap, size); });
+
+    sink = bc::bitcount(size, (const uint8_t*) *mmap).ones;
+  });
+
+  report(what, size, secs);
+}
+
+int main(int argc, const char *const *argv) {
+  const size_t size = ((argc > 1) ? strtoull(argv[1], nullptr, 10) : 1024) * 1024 * 1024;
+
+  if (size == 0) {
+    fprintf(stderr, "usage: %s [SIZE_MB [FILE]]\n", argv[0]);
+    return 1;
+  }
+
+  /// *** buffers in memory
+
+  bench_buffer("buffer, normal pages", Bitcount_Buffer::allocate(size), size);
+  bench_buffer("buffer, huge pages", Bitcount_Buffer::allocate_huge(size), size);
+
+  /// *** file mappings, the file is in the page cache after the first run
+
+  std::string path;
+  int fd;
+
+  if (argc > 2) {
+    path = argv[2];
+
+    auto ret = sys::open(path);
+    if (!ret) {
+      fprintf(stderr, "error: could not open %s: %s\n", path.c_str(), ret.get_error().message().c_str());
+      return 1;
+    }
+    fd = *ret;
+  } else {
+    const char *tmp = getenv("TMPDIR");
+
+    auto ret = sys::create_temp_file(tmp ? tmp : "/tmp", path);
+    if (!ret) {
+      fprintf(stderr, "error: could not create scratch file: %s\n", ret.get_error().message().c_str());
+      return 1;
+    }
+    fd = *ret;
+    sys::unlink(path);
+
+    Bitcount_Buffer chunk = Bitcount_Buffer::allocate(sys::HUGE_PAGE_SIZE);
+    memset(chunk.get(), 0x5a, sys::HUGE_PAGE_SIZE);
+
+    for (size_t done = 0; done < size; done += sys::HUGE_PAGE_SIZE) {
+      if (!sys::write(fd, std::min(sys::HUGE_PAGE_SIZE, size - done), chunk.get())) {
+        fprintf(stderr, "error: could not write scratch file\n");
+        return 1;
+      }
+    }
+  }
+  auto closer = on_exit([&]() { sys::close(fd); });
+
+  auto stat = sys::stat(fd);
+  const size_t file_size = stat ? std::min(size, stat->size) : 0;
+
+  if (file_size == 0) {
+    fprintf(stderr, "error: empty file\n");
+    return 1;
+  }
+
+  bench_mmap("mmap",                     fd, file_size, sys::MMAP_DEFAULT);
+  bench_mmap("mmap, huge pages",         fd, file_size, sys::MMAP_HUGE);
+  bench_mmap("mmap, populate",           fd, file_size, sys::MMAP_POPULATE);
+  bench_mmap("mmap, huge pages+populate", fd, file_size, sys::MMAP_HUGE | sys::MMAP_POPULATE);
+}
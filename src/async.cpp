@@ -0,0 +1,300 @@
+
+#include "async.hpp"
+#include "on_exit.hpp"
+#include "sys.hpp"
+#include <algorithm>     // std::max
+#include <atomic>        // std::atomic
+#include <cassert>       // assert
+#include <cstdio>        // fprintf
+#include <iterator>      // std::size
+#include <unordered_map> // std::unordered_map
+
+using namespace bc;
+
+/// ***** executors
+
+bc::Thread_Pool::Thread_Pool(size_t num_threads) {
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  for (size_t i = 0; i < num_threads; i++) {
+    _threads.emplace_back([this]() { run(); });
+  }
+}
+
+bc::Thread_Pool::~Thread_Pool() {
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _stop = true;
+  }
+  _cond.notify_all();
+
+  for (std::thread &thread : _threads) {
+    thread.join();
+  }
+}
+
+void bc::Thread_Pool::post(std::function<void()> work) {
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _queue.push_back(std::move(work));
+  }
+  _cond.notify_one();
+}
+
+void bc::Thread_Pool::run() {
+  while (true) {
+    std::function<void()> work;
+    {
+      std::unique_lock<std::mutex> lock{_mutex};
+      _cond.wait(lock, [&]() { return _stop || !_queue.empty(); });
+
+      if (_queue.empty()) {
+        return;
+      }
+
+      work = std::move(_queue.front());
+      _queue.pop_front();
+    }
+
+    work();
+  }
+}
+
+/// ***** readers
+
+namespace {
+
+/// read() or pread() on a thread of the executor. Nothing to set up, works everywhere.
+struct Blocking_Reader final : Async_Reader {
+  explicit Blocking_Reader(Executor &executor) : _executor{executor} {}
+
+  void read(int fd, size_t count, int64_t offset, uint8_t *buf,
+            std::function<void(Result<size_t, std::error_code>)> done) override {
+    _executor.post([=, done = std::move(done)]() {
+      auto ret = offset == sys::IO_CURRENT_POSITION ? sys::read(fd, count, buf) : sys::pread(fd, count, size_t(offset), buf);
+
+      if (ret) {
+        done(size_t(*ret));
+      } else {
+        done(ret.get_error());
+      }
+    });
+  }
+
+  const char *name() const override { return "blocking"; }
+private:
+  Executor &_executor;
+};
+
+/// Reads go to the kernel through an io_uring, one thread waits for completions and hands them to the executor.
+/// Counting happens on the executor, so the waiting thread is free to reap the next completion right away.
+struct Io_Uring_Reader final : Async_Reader {
+  /// submissions in flight can be more than this, the kernel keeps completions that don't fit (IORING_FEAT_NODROP)
+  static constexpr unsigned RING_ENTRIES = 256;
+
+  using Done = std::function<void(Result<size_t, std::error_code>)>;
+
+  Io_Uring_Reader(Executor &executor, sys::Io_Ring *ring)
+  : _executor{executor}, _ring{ring}, _thread{[this]() { run(); }} {}
+
+  ~Io_Uring_Reader() override {
+    _stop.store(true, std::memory_order_release);
+    sys::io_ring_wake(_ring);
+
+    _thread.join();
+    sys::io_ring_destroy(_ring);
+  }
+
+  void read(int fd, size_t count, int64_t offset, uint8_t *buf, Done done) override {
+    /// The kernel only passes an id along, the callback stays here. Taking it in and out under
+    /// the mutex is what orders read() before the completion thread (for us and for TSan).
+    uint64_t id;
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+
+      /// nobody reaps completions any more, a read we submit now would never finish
+      if (_failure) {
+        _executor.post([done = std::move(done), err = _failure]() {
+          done(err);
+        });
+        return;
+      }
+
+      id = _next_id++;
+      _pending.emplace(id, std::move(done));
+    }
+
+    auto ret = sys::io_ring_read(_ring, fd, count, offset, buf, id);
+    if (!ret) {
+      /// not submitted, so it never completes and the callback is still ours
+      _executor.post([done = take(id), err = ret.get_error()]() {
+        done(err);
+      });
+    }
+  }
+
+  const char *name() const override { return "io_uring"; }
+private:
+  Done take(uint64_t id) {
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    auto it = _pending.find(id);
+    assert(it != _pending.end() && "completion for a read we don't know about");
+
+    Done done = std::move(it->second);
+    _pending.erase(it);
+    return done;
+  }
+
+  void run() {
+    sys::Io_Completion completions[64];
+
+    while (!_stop.load(std::memory_order_acquire)) {
+      auto num = sys::io_ring_wait(_ring, std::size(completions), completions);
+      if (!num) {
+        /// nothing sensible left to do, reads still in flight never finish and new ones fail right away
+        fprintf(stderr, "error: waiting for io_uring completions failed: %s\n", num.get_error().message().c_str());
+
+        std::lock_guard<std::mutex> lock{_mutex};
+        _failure = num.get_error();
+        return;
+      }
+
+      for (size_t i = 0; i < *num; i++) {
+        const sys::Io_Completion &completion = completions[i];
+
+        _executor.post([done = take(completion.user_data), completion]() {
+          if (completion.error) {
+            done(completion.error);
+          } else {
+            done(completion.bytes);
+          }
+        });
+      }
+    }
+  }
+
+  Executor                           &_executor;
+  sys::Io_Ring                       *_ring;
+  std::atomic<bool>                   _stop{false};
+  std::mutex                          _mutex;
+  uint64_t                            _next_id = 1;
+  std::unordered_map<uint64_t, Done>  _pending;
+  /// why run() gave up, if it did
+  std::error_code                     _failure;
+  std::thread                         _thread;
+};
+
+} // end anonymous namespace
+
+std::unique_ptr<Async_Reader> bc::Async_Reader::create(Executor &executor) {
+  auto ring = sys::io_ring_create(Io_Uring_Reader::RING_ENTRIES);
+  if (ring) {
+    return std::make_unique<Io_Uring_Reader>(executor, *ring);
+  }
+
+  /// no io_uring in this kernel, or it is disabled (e.g. by seccomp in containers)
+  return create_blocking(executor);
+}
+
+std::unique_ptr<Async_Reader> bc::Async_Reader::create_blocking(Executor &executor) {
+  return std::make_unique<Blocking_Reader>(executor);
+}
+
+Async_Reader &bc::default_async_reader() {
+  /// destroyed in reverse order, i.e. the reader before the pool it posts to
+  static Thread_Pool                   pool;
+  static std::unique_ptr<Async_Reader> reader = Async_Reader::create(pool);
+
+  return *reader;
+}
+
+/// ***** coroutines
+
+bc::Async_Read::Async_Read(Async_Reader &reader, int fd, size_t count, int64_t offset, uint8_t *buf)
+: _state{std::make_shared<State>()} {
+  reader.read(fd, count, offset, buf, [state = _state](Result<size_t, std::error_code> result) {
+    std::coroutine_handle<> awaiting;
+    {
+      std::lock_guard<std::mutex> lock{state->mutex};
+      state->result.emplace(std::move(result));
+      awaiting = state->awaiting;
+    }
+
+    /// we are on the executor already, so just carry on with whoever waits for us
+    if (awaiting) {
+      awaiting.resume();
+    }
+  });
+}
+
+bool bc::Async_Read::await_suspend(std::coroutine_handle<> awaiting) {
+  std::lock_guard<std::mutex> lock{_state->mutex};
+
+  if (_state->result) {
+    return false;
+  }
+
+  _state->awaiting = awaiting;
+  return true;
+}
+
+Result<size_t, std::error_code> bc::Async_Read::await_resume() {
+  std::lock_guard<std::mutex> lock{_state->mutex};
+  return std::move(*_state->result);
+}
+
+/// ***** counting
+
+Task<Result<Count, Error>> bc::async_bitcount(Async_Reader &reader, std::string file, size_t chunk_size, Kernel kernel) {
+  /// opening a file is quick, unlike reading it
+  auto fd = sys::open(file);
+  if (!fd) {
+    co_return Error{fd, "could not open file " + escape(file)};
+  }
+  auto closer = on_exit([&]() { sys::close(*fd); });
+
+  /// reads at offsets can be in flight two at a time, reads from pipes & such have to take turns
+  auto stat = sys::stat(*fd);
+  const bool seekable = stat && (stat->type == sys::Stat::REGULAR || stat->type == sys::Stat::BLOCK);
+
+  Bitcount_Buffer buffers[2] = {Bitcount_Buffer::allocate(chunk_size), Bitcount_Buffer::allocate(chunk_size)};
+
+  size_t offset = 0;
+  auto read_into = [&](Bitcount_Buffer &buffer) {
+    return Async_Read{reader, *fd, chunk_size, seekable ? int64_t(offset) : sys::IO_CURRENT_POSITION, buffer.get()};
+  };
+
+  Count      accum;
+  Async_Read read = read_into(buffers[0]);
+
+  /// no read may be in flight when we return, the buffers it reads into go away with us
+  for (size_t i = 0;; i ^= 1) {
+    auto got = co_await read;
+    if (!got) {
+      co_return Error{got, "error reading file " + escape(file)};
+    }
+    if (*got == 0) {
+      break;
+    }
+    offset += *got;
+
+    if (seekable) {
+      read = read_into(buffers[i ^ 1]);
+    }
+
+    accum += bc::bitcount(*got, buffers[i].get(), kernel);
+
+    if (!seekable) {
+      read = read_into(buffers[i ^ 1]);
+    }
+  }
+
+  co_return accum;
+}
+
+Task<Result<Count, Error>> bc::async_bitcount(std::string file) {
+  return async_bitcount(default_async_reader(), std::move(file));
+}
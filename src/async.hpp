@@ -0,0 +1,225 @@
+
+#pragma once
+
+#include "bitcnt.hpp"         // bc::Count, bc::Kernel
+#include "error.hpp"          // bc::Error
+#include "result.hpp"         // bc::Result
+#include <condition_variable> // std::condition_variable
+#include <coroutine>          // std::coroutine_handle, std::suspend_always, ...
+#include <cstdint>            // uint8_t, int64_t
+#include <deque>              // std::deque
+#include <exception>          // std::terminate
+#include <functional>         // std::function
+#include <memory>             // std::unique_ptr, std::shared_ptr
+#include <mutex>              // std::mutex
+#include <optional>           // std::optional
+#include <string>             // std::string
+#include <system_error>       // std::error_code
+#include <thread>             // std::thread
+#include <utility>            // std::move, std::exchange
+#include <vector>             // std::vector
+
+namespace bc {
+
+/// ***** executors
+
+/// Runs work posted from any thread, on threads of its own.
+/// Reads complete and coroutines resume on the executor, never on the thread that posted.
+struct Executor {
+  virtual ~Executor() = default;
+
+  /// must not block
+  virtual void post(std::function<void()> work) = 0;
+};
+
+/// A fixed number of threads taking work from one queue.
+struct Thread_Pool final : Executor {
+  /// 0 means one thread per CPU
+  explicit Thread_Pool(size_t num_threads = 0);
+  Thread_Pool(const Thread_Pool&) = delete;
+
+  /// runs everything posted so far, then joins the threads
+  ~Thread_Pool() override;
+
+  void post(std::function<void()> work) override;
+private:
+  void run();
+
+  std::mutex                        _mutex;
+  std::condition_variable           _cond;
+  std::deque<std::function<void()>> _queue;
+  bool                              _stop = false;
+  std::vector<std::thread>          _threads;
+};
+
+/// ***** reads
+
+/// Reads without blocking the caller, done is called on the executor.
+struct Async_Reader {
+  /// io_uring if the kernel has it, blocking reads on the executor's threads otherwise
+  static std::unique_ptr<Async_Reader> create(Executor &executor);
+
+  /// always blocking reads on the executor's threads
+  static std::unique_ptr<Async_Reader> create_blocking(Executor &executor);
+
+  /// all reads must be done before
+  virtual ~Async_Reader() = default;
+
+  /// read up to count bytes at offset (or sys::IO_CURRENT_POSITION) into buf, which must stay valid until done is called
+  virtual void read(int fd, size_t count, int64_t offset, uint8_t *buf,
+                    std::function<void(Result<size_t, std::error_code>)> done) = 0;
+
+  /// "io_uring" or "blocking", for logs & tests
+  virtual const char *name() const = 0;
+};
+
+/// Reader used by the overloads without one: io_uring (if possible) plus a Thread_Pool with a thread per CPU
+Async_Reader &default_async_reader();
+
+/// ***** coroutines
+
+/// A coroutine producing a T, it starts running when it is awaited (or passed to start() or sync_wait()).
+template<typename T>
+struct [[nodiscard]] Task final {
+  struct promise_type final {
+    Task get_return_object() {
+      return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    /// hand over to whoever awaits us, without growing the stack
+    struct Final_Awaiter final {
+      bool await_ready() noexcept { return false; }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> self) noexcept {
+        return self.promise().continuation;
+      }
+
+      void await_resume() noexcept {}
+    };
+
+    Final_Awaiter final_suspend() noexcept { return {}; }
+
+    void return_value(T value) {
+      result.emplace(std::move(value));
+    }
+
+    /// errors are values in bc, anything thrown is a bug
+    void unhandled_exception() {
+      std::terminate();
+    }
+
+    std::optional<T>        result;
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+  };
+
+  Task(Task &&that) : _handle{std::exchange(that._handle, nullptr)} {}
+  Task(const Task&) = delete;
+
+  ~Task() {
+    if (_handle) {
+      _handle.destroy();
+    }
+  }
+
+  /// awaitable
+
+  bool await_ready() const noexcept { return false; }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+    _handle.promise().continuation = awaiting;
+    return _handle;
+  }
+
+  T await_resume() {
+    return std::move(*_handle.promise().result);
+  }
+private:
+  explicit Task(std::coroutine_handle<promise_type> handle) : _handle{handle} {}
+
+  std::coroutine_handle<promise_type> _handle;
+};
+
+namespace detail {
+
+/// coroutine nobody awaits, it cleans up after itself
+struct Detached final {
+  struct promise_type final {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+template<typename T>
+Detached run_detached(Task<T> task, std::function<void(T)> done) {
+  done(co_await task);
+}
+
+} // end namespace detail
+
+/// Run a task for callers that aren't coroutines themselves, e.g. event loops.
+/// done gets the result, on whatever thread the task finishes on.
+template<typename T>
+void start(Task<T> task, std::function<void(T)> done) {
+  detail::run_detached(std::move(task), std::move(done));
+}
+
+/// Run a task and block until it is done. For tests & command line tools, not for event loops.
+template<typename T>
+T sync_wait(Task<T> task) {
+  std::mutex              mutex;
+  std::condition_variable cond;
+  std::optional<T>        result;
+
+  start<T>(std::move(task), [&](T value) {
+    std::lock_guard<std::mutex> lock{mutex};
+    result.emplace(std::move(value));
+    cond.notify_one();
+  });
+
+  std::unique_lock<std::mutex> lock{mutex};
+  cond.wait(lock, [&]() { return result.has_value(); });
+  return std::move(*result);
+}
+
+/// A read that starts right away and can be awaited later, so it runs while we do something else.
+struct Async_Read final {
+  Async_Read(Async_Reader &reader, int fd, size_t count, int64_t offset, uint8_t *buf);
+  Async_Read(Async_Read&&) = default;
+  Async_Read &operator=(Async_Read&&) = default;
+
+  bool await_ready() const noexcept { return false; }
+
+  /// false (i.e. don't suspend) if the read is done already
+  bool await_suspend(std::coroutine_handle<> awaiting);
+
+  Result<size_t, std::error_code> await_resume();
+private:
+  /// shared with the completion callback, which may run before or after we are awaited
+  struct State final {
+    std::mutex                                     mutex;
+    std::optional<Result<size_t, std::error_code>> result;
+    std::coroutine_handle<>                        awaiting;
+  };
+
+  std::shared_ptr<State> _state;
+};
+
+/// ***** counting
+
+/// size of the reads async_bitcount() keeps in flight, two per file
+const constexpr size_t ASYNC_CHUNK_SIZE = 1024 * 1024;
+
+/// Count the bits in a file without blocking the caller.
+/// Regular files always have the next chunk being read while the current one is counted.
+Task<Result<Count, Error>> async_bitcount(Async_Reader &reader, std::string file,
+                                          size_t chunk_size = ASYNC_CHUNK_SIZE, Kernel kernel = DEFAULT_KERNEL);
+
+/// Same as above, with the default_async_reader()
+Task<Result<Count, Error>> async_bitcount(std::string file);
+
+} // end namespace bc
@@ -1,4 +1,6 @@
 
+#pragma once
+
 /// Helper header for making it easy to enable/disable OpenMP macros without lots of #ifdefs
 /// Yes, OpenMP pragmas are ignored when compiling without -fopenmp ...
 /// but GCC/Clang give lots of warnings, and I really like -Wall and dislike disabling single warnings.
@@ -8,7 +10,40 @@
 #define BC_STRINGIFY(X)  BC_STRINGIFY_(X)
 
 #ifdef _OPENMP
+#  include <omp.h>
 #  define BC_OMP(X) _Pragma(BC_STRINGIFY(omp X))
 #else
 #  define BC_OMP(X)
 #endif
+
+/// Same deal for the handful of OpenMP runtime functions we need.
+namespace bc::omp {
+
+/// id of the calling thread in the current team
+inline int thread_num() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+/// upper bound on the number of threads in a parallel region
+inline int max_threads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+/// true if called from inside an active parallel region
+inline bool in_parallel() {
+#ifdef _OPENMP
+  return omp_in_parallel();
+#else
+  return false;
+#endif
+}
+
+} // end namespace bc::omp
@@ -2,10 +2,13 @@
 #include "bc_openmp.hpp"
 #include "bitcnt.hpp"
 #include "config.h"
-#include <cassert> // for assert
-#include <cstdint> // for uint32_t
-#include <cstdlib> // for posix_memalign, abort
-#include <cstdio>  // for fprintf
+#include "progress.hpp"
+#include "sys.hpp"
+#include <algorithm> // for std::min
+#include <cassert>   // for assert
+#include <cstdint>   // for uint32_t
+#include <cstdlib>   // for posix_memalign, abort
+#include <cstdio>    // for fprintf
 
 using namespace bc;
 
@@ -99,6 +102,24 @@ static uint64_t popcount_chunk(const Chunk &data) {
   return sum;
 }
 
+/// popcount for a whole chunk using the compiler builtin on 64-bit words
+static uint64_t popcount_chunk_builtin(const Chunk &data) {
+  uint64_t sum = 0;
+
+#if BC_HAVE_BUILTIN_POPCOUNT
+  const uint64_t *words = (const uint64_t*) data.data;
+
+  for (size_t i = 0; i < sizeof(Chunk) / sizeof(uint64_t); i++) {
+    sum += __builtin_popcountll(words[i]);
+  }
+#else
+  (void) data;
+  assert(false && "builtin popcount not available");
+#endif
+
+  return sum;
+}
+
 template<typename DstT, typename PtrT>
 static const DstT *align_down(PtrT *ptr) {
   const uintptr_t raw     = (uintptr_t) ptr;
@@ -107,12 +128,27 @@ static const DstT *align_down(PtrT *ptr) {
   return (const DstT*) aligned;
 }
 
-Count bc::bitcount(size_t size, const uint8_t *data) {
-  assert((uintptr_t(data) % ALIGNMENT == 0) && "Data is not sufficiently aligned");
-
+template<uint64_t (*PopcountChunk)(const Chunk&)>
+static Count bitcount_impl(size_t size, const uint8_t *data) {
   const size_t num_bits = size * 8;
   size_t num_ones = 0;
 
+  /// Bytes before the first aligned chunk, if the caller didn't align the data for us
+
+  const size_t head = std::min(size, (ALIGNMENT - uintptr_t(data) % ALIGNMENT) % ALIGNMENT);
+
+  for (size_t i = 0; i < head; i++) {
+    num_ones += popcount_32(data[i]);
+  }
+
+  data += head;
+  size -= head;
+
+  /// all of it was head, so data may still not be aligned
+  if (size == 0) {
+    return Count{num_ones, num_bits - num_ones};
+  }
+
   const Chunk *__restrict__ const chunks_bgn = (const Chunk*) data;
   const Chunk *__restrict__ const chunks_end = align_down<Chunk>(data + size);
 
@@ -129,10 +165,10 @@ Count bc::bitcount(size_t size, const uint8_t *data) {
   assert(bytes_bgn <= bytes_end);
 
   /// First do 64 byte (= 512 bit = 16 uint32_t) chunks.
-  /// Use SWAR popcount which the compiler should be able to vectorize.
+  /// Use the chunk kernel, by default SWAR popcount which the compiler should be able to vectorize.
   /// 512 bits is completely arbiratry and not at all related to AVX512 register size.
   for (const Chunk *it = chunks_bgn; it != chunks_end; it++) {
-    num_ones += popcount_chunk(*it);
+    num_ones += PopcountChunk(*it);
   }
 
   /// Do 32-bit chunks
@@ -157,6 +193,71 @@ Count bc::bitcount(size_t size, const uint8_t *data) {
   return cnt;
 }
 
+const char *bc::kernel_name(Kernel kernel) {
+  switch (kernel) {
+  case Kernel::CHUNKED_SWAR:
+    return "chunked-swar";
+  case Kernel::BUILTIN:
+    return "builtin";
+  }
+  return "???";
+}
+
+bool bc::kernel_available(Kernel kernel) {
+  switch (kernel) {
+  case Kernel::CHUNKED_SWAR:
+    return true;
+  case Kernel::BUILTIN:
+    return BC_HAVE_BUILTIN_POPCOUNT;
+  }
+  return false;
+}
+
+Count bc::bitcount(size_t size, const uint8_t *data) {
+  return bitcount(size, data, DEFAULT_KERNEL);
+}
+
+Count bc::bitcount(size_t size, const uint8_t *data, Kernel kernel) {
+  assert(kernel_available(kernel));
+
+  switch (kernel) {
+  case Kernel::CHUNKED_SWAR:
+    return bitcount_impl<popcount_chunk>(size, data);
+  case Kernel::BUILTIN:
+    return bitcount_impl<popcount_chunk_builtin>(size, data);
+  }
+
+  abort();
+}
+
+Count bc::parallel_bitcount(size_t size, const uint8_t *data, Kernel kernel, Progress *progress) {
+  /// big enough to amortize scheduling, and a multiple of ALIGNMENT so every range stays aligned
+  const size_t RANGE_SIZE = 1024 * 1024;
+  static_assert(RANGE_SIZE % ALIGNMENT == 0);
+
+  const long num_ranges = long((size + RANGE_SIZE - 1) / RANGE_SIZE);
+
+  size_t num_ones = 0;
+
+  BC_OMP(parallel for reduction(+: num_ones) schedule(dynamic))
+  for (long i = 0; i < num_ranges; i++) {
+    const size_t bgn = size_t(i) * RANGE_SIZE;
+    const size_t len = (size - bgn < RANGE_SIZE) ? (size - bgn) : RANGE_SIZE;
+
+    const Count cnt = bitcount(len, data + bgn, kernel);
+    num_ones += cnt.ones;
+
+    if (progress) {
+      progress->add(cnt);
+    }
+  }
+
+  Count cnt;
+  cnt.ones   = num_ones;
+  cnt.zeroes = size * 8 - num_ones;
+  return cnt;
+}
+
 Bitcount_Buffer bc::Bitcount_Buffer::allocate(size_t size) {
   /// NOTE: mac 10.3 does not have aligned_alloc
   void *data = nullptr;
@@ -169,7 +270,37 @@ Bitcount_Buffer bc::Bitcount_Buffer::allocate(size_t size) {
   return Bitcount_Buffer{(uint8_t*) data};
 }
 
+Bitcount_Buffer bc::Bitcount_Buffer::allocate_huge(size_t size) {
+  const size_t huge_size = (size + sys::HUGE_PAGE_SIZE - 1) / sys::HUGE_PAGE_SIZE * sys::HUGE_PAGE_SIZE;
+
+  if (huge_size == 0) {
+    return allocate(size);
+  }
+
+  /// explicit huge pages, if the admin reserved some
+  auto mapping = sys::mmap_huge(huge_size);
+  if (mapping) {
+    return Bitcount_Buffer{(uint8_t*) *mapping, huge_size};
+  }
+
+  /// otherwise ask for transparent huge pages, for which the memory must be aligned to the huge page size
+  void *data = nullptr;
+
+  if (posix_memalign(&data, sys::HUGE_PAGE_SIZE, huge_size) != 0) {
+    fprintf(stderr, "bc::alloc_bitcount_buffer: out of memory\n");
+    abort();
+  }
+
+  sys::advise_huge(data, huge_size);
+
+  return Bitcount_Buffer{(uint8_t*) data};
+}
+
 bc::Bitcount_Buffer::~Bitcount_Buffer() {
-  std::free(_ptr);
+  if (_mapped_size) {
+    sys::munmap(_ptr, _mapped_size);
+  } else {
+    std::free(_ptr);
+  }
   _ptr = nullptr;
 }
@@ -7,6 +7,8 @@
 
 namespace bc {
 
+struct Progress;
+
 struct Count final {
   size_t ones = 0;
   size_t zeroes = 0;
@@ -35,22 +37,58 @@ struct Count final {
   }
 };
 
-/// Data must be aligned to 64 bytes
+/// The different ways we know to count bits, which one is fastest depends on the CPU.
+enum class Kernel {
+  /// SWAR popcount on 64 byte chunks, written so the compiler can vectorize it
+  CHUNKED_SWAR,
+  /// __builtin_popcountll on 64-bit words, i.e. the POPCNT instruction if the target has one
+  BUILTIN,
+};
+
+/// Kernel used when none is given explicitly
+const constexpr Kernel DEFAULT_KERNEL = Kernel::CHUNKED_SWAR;
+
+const constexpr Kernel ALL_KERNELS[] = {Kernel::CHUNKED_SWAR, Kernel::BUILTIN};
+
+/// name of a kernel, for config files & humans
+const char *kernel_name(Kernel kernel);
+
+/// false if kernel is not available in this build
+bool kernel_available(Kernel kernel);
+
+/// Fastest if data is aligned to 64 bytes, bytes before the first aligned 64 bytes are counted one by one
 Count bitcount(size_t size, const uint8_t *data);
 
+/// Same as above, but with an explicit kernel (which must be available)
+Count bitcount(size_t size, const uint8_t *data, Kernel kernel);
+
+/// Same as above, but split into ranges counted by all threads of the OpenMP team.
+/// Every range is added to progress, if it is not null.
+Count parallel_bitcount(size_t size, const uint8_t *data, Kernel kernel, Progress *progress = nullptr);
+
 /// Wrapper for data properly aligned for bitcount().
 struct Bitcount_Buffer {
   static Bitcount_Buffer allocate(size_t size);
 
-  Bitcount_Buffer(Bitcount_Buffer &&that) : _ptr{that._ptr} { that._ptr = nullptr; }
+  /// Same as above, but backed by 2 MiB huge pages if possible, to save on TLB misses.
+  /// Tries explicit (hugetlbfs) pages first, then transparent huge pages.
+  /// size is rounded up to a multiple of the huge page size.
+  static Bitcount_Buffer allocate_huge(size_t size);
+
+  Bitcount_Buffer(Bitcount_Buffer &&that) : _ptr{that._ptr}, _mapped_size{that._mapped_size} {
+    that._ptr         = nullptr;
+    that._mapped_size = 0;
+  }
   Bitcount_Buffer(const Bitcount_Buffer&) = delete;
   ~Bitcount_Buffer();
 
   uint8_t *get() { return _ptr; }
 private:
-  explicit Bitcount_Buffer(uint8_t *ptr) : _ptr{ptr} {}
+  explicit Bitcount_Buffer(uint8_t *ptr, size_t mapped_size = 0) : _ptr{ptr}, _mapped_size{mapped_size} {}
 
   uint8_t *_ptr;
+  /// size of the mapping if _ptr comes from mmap_huge, 0 if it comes from posix_memalign
+  size_t   _mapped_size;
 };
 
 } // end namespace bc
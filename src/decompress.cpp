@@ -0,0 +1,229 @@
+
+#include "decompress.hpp"
+#include "config.h"
+#include <algorithm> // std::min
+#include <climits>   // UINT_MAX
+#include <string>    // std::string
+
+#if BC_HAVE_ZLIB
+#  include <zlib.h>  // for inflate, inflateInit2, inflateReset, ...
+#endif
+
+#if BC_HAVE_LIBZSTD
+#  include <zstd.h>  // for ZSTD_decompressStream, ZSTD_findFrameCompressedSize, ...
+#endif
+
+using namespace bc;
+
+static Error decompress_error(const std::string &msg) {
+  return Error{std::make_error_code(std::errc::invalid_argument), msg};
+}
+
+Compression bc::detect_compression(size_t size, const uint8_t *data) {
+  if (size >= 2 && data[0] == 0x1f && data[1] == 0x8b) {
+    return Compression::GZIP;
+  }
+
+  /// 0xFD2FB528, little endian
+  if (size >= 4 && data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f && data[3] == 0xfd) {
+    return Compression::ZSTD;
+  }
+
+  return Compression::NONE;
+}
+
+const char *bc::compression_name(Compression compression) {
+  switch (compression) {
+  case Compression::NONE: return "none";
+  case Compression::GZIP: return "gzip";
+  case Compression::ZSTD: return "zstd";
+  }
+  return "unknown";
+}
+
+bool bc::compression_available(Compression compression) {
+  switch (compression) {
+  case Compression::NONE: return false;
+  case Compression::GZIP: return BC_HAVE_ZLIB;
+  case Compression::ZSTD: return BC_HAVE_LIBZSTD;
+  }
+  return false;
+}
+
+/// ***** gzip
+
+#if BC_HAVE_ZLIB
+namespace {
+
+struct Gzip_Decompressor final : Decompressor {
+  Gzip_Decompressor() = default;
+  Gzip_Decompressor(const Gzip_Decompressor&) = delete;
+
+  ~Gzip_Decompressor() override {
+    inflateEnd(&_stream);
+  }
+
+  bool init() {
+    /// 16 + max window bits: gzip only, no raw deflate or zlib headers
+    return inflateInit2(&_stream, 16 + MAX_WBITS) == Z_OK;
+  }
+
+  Result<size_t, Error> decompress(size_t in_size, const uint8_t *in, size_t &in_used,
+                                   size_t out_size, uint8_t *out) override {
+    size_t written = 0;
+
+    while (written < out_size) {
+      if (!_in_member) {
+        /// don't start a new member unless there is input for it
+        if (in_used == in_size) {
+          break;
+        }
+        inflateReset(&_stream);
+        _in_member = true;
+      }
+
+      /// zlib counts in uInt
+      const uInt avail_in  = uInt(std::min<size_t>(in_size - in_used, UINT_MAX));
+      const uInt avail_out = uInt(std::min<size_t>(out_size - written, UINT_MAX));
+
+      _stream.next_in   = const_cast<Bytef*>(in + in_used);
+      _stream.avail_in  = avail_in;
+      _stream.next_out  = out + written;
+      _stream.avail_out = avail_out;
+
+      const int ret = inflate(&_stream, Z_NO_FLUSH);
+
+      const size_t consumed = avail_in - _stream.avail_in;
+      const size_t produced = avail_out - _stream.avail_out;
+      in_used += consumed;
+      written += produced;
+
+      if (ret == Z_STREAM_END) {
+        _in_member = false;
+      } else if (ret == Z_BUF_ERROR || (ret == Z_OK && consumed == 0 && produced == 0)) {
+        /// needs more input
+        break;
+      } else if (ret != Z_OK) {
+        return decompress_error(std::string{"corrupt gzip data: "} + (_stream.msg ? _stream.msg : "unknown error"));
+      }
+    }
+
+    return written;
+  }
+
+  bool complete() const override {
+    return !_in_member;
+  }
+private:
+  z_stream _stream{};
+  bool     _in_member = false;
+};
+
+} // end anonymous namespace
+#endif
+
+/// ***** zstd
+
+#if BC_HAVE_LIBZSTD
+namespace {
+
+struct Zstd_Decompressor final : Decompressor {
+  Zstd_Decompressor() : _ctx{ZSTD_createDCtx()} {}
+  Zstd_Decompressor(const Zstd_Decompressor&) = delete;
+
+  ~Zstd_Decompressor() override {
+    ZSTD_freeDCtx(_ctx);
+  }
+
+  bool init() {
+    return _ctx != nullptr;
+  }
+
+  Result<size_t, Error> decompress(size_t in_size, const uint8_t *in, size_t &in_used,
+                                   size_t out_size, uint8_t *out) override {
+    ZSTD_inBuffer  in_buf{in, in_size, in_used};
+    ZSTD_outBuffer out_buf{out, out_size, 0};
+
+    /// decompressStream moves on to the next frame by itself
+    while (out_buf.pos < out_buf.size) {
+      const size_t in_before  = in_buf.pos;
+      const size_t out_before = out_buf.pos;
+
+      const size_t ret = ZSTD_decompressStream(_ctx, &out_buf, &in_buf);
+      if (ZSTD_isError(ret)) {
+        return decompress_error(std::string{"corrupt zstd data: "} + ZSTD_getErrorName(ret));
+      }
+
+      if (in_buf.pos == in_before && out_buf.pos == out_before) {
+        break;
+      }
+
+      /// 0 once a frame is completely decoded & flushed, calls that do nothing return a hint for the next one
+      _in_frame = ret != 0;
+    }
+
+    in_used = in_buf.pos;
+    return out_buf.pos;
+  }
+
+  bool complete() const override {
+    return !_in_frame;
+  }
+private:
+  ZSTD_DCtx *_ctx;
+  bool       _in_frame = false;
+};
+
+} // end anonymous namespace
+#endif
+
+Result<std::unique_ptr<Decompressor>, Error> bc::Decompressor::create(Compression compression) {
+  const std::string name = compression_name(compression);
+
+  if (!compression_available(compression)) {
+    return Error{std::make_error_code(std::errc::not_supported), "no support for " + name + " compression in this build"};
+  }
+
+#if BC_HAVE_ZLIB
+  if (compression == Compression::GZIP) {
+    auto gzip = std::make_unique<Gzip_Decompressor>();
+    if (gzip->init()) {
+      return std::unique_ptr<Decompressor>{std::move(gzip)};
+    }
+  }
+#endif
+
+#if BC_HAVE_LIBZSTD
+  if (compression == Compression::ZSTD) {
+    auto zstd = std::make_unique<Zstd_Decompressor>();
+    if (zstd->init()) {
+      return std::unique_ptr<Decompressor>{std::move(zstd)};
+    }
+  }
+#endif
+
+  return Error{std::make_error_code(std::errc::not_enough_memory), "could not set up " + name + " decompression"};
+}
+
+Result<std::vector<Compressed_Frame>, Error> bc::zstd_frames(size_t size, const uint8_t *data) {
+#if BC_HAVE_LIBZSTD
+  std::vector<Compressed_Frame> frames;
+
+  /// skippable frames are listed too, they just decompress to nothing
+  for (size_t offset = 0; offset < size;) {
+    const size_t frame_size = ZSTD_findFrameCompressedSize(data + offset, size - offset);
+    if (ZSTD_isError(frame_size)) {
+      return decompress_error(std::string{"corrupt zstd data: "} + ZSTD_getErrorName(frame_size));
+    }
+
+    frames.push_back(Compressed_Frame{offset, frame_size});
+    offset += frame_size;
+  }
+
+  return frames;
+#else
+  (void) size;
+  (void) data;
+  return Error{std::make_error_code(std::errc::not_supported), "no support for zstd compression in this build"};
+#endif
+}
@@ -0,0 +1,60 @@
+
+#pragma once
+
+#include "error.hpp"  // bc::Error
+#include "result.hpp" // bc::Result
+#include <cstddef>    // size_t
+#include <cstdint>    // uint8_t
+#include <memory>     // std::unique_ptr
+#include <vector>     // std::vector
+
+namespace bc {
+
+/// Compression formats we recognize by their magic bytes
+enum class Compression {
+  NONE,
+  GZIP,
+  ZSTD,
+};
+
+/// detect_compression() never looks at more than this many bytes
+const constexpr size_t COMPRESSION_MAGIC_SIZE = 4;
+
+/// NONE if the first bytes of a file don't look like anything we can decompress
+Compression detect_compression(size_t size, const uint8_t *data);
+
+/// name of a format, for error messages & humans
+const char *compression_name(Compression compression);
+
+/// false if the library for a format was not found when building
+bool compression_available(Compression compression);
+
+/// Decompresses a stream piece by piece, without ever holding all of it in memory.
+/// Concatenated gzip members and zstd frames are decompressed one after the other.
+struct Decompressor {
+  /// Fails if compression is NONE or not available
+  static Result<std::unique_ptr<Decompressor>, Error> create(Compression compression);
+
+  virtual ~Decompressor() = default;
+
+  /// Decompress from in (starting at in_used) into out, until out is full or no more progress can be made.
+  /// Advances in_used past the input we consumed and returns how many bytes we wrote to out.
+  /// Output that didn't fit is kept and returned by the next call, even if there is no more input.
+  virtual Result<size_t, Error> decompress(size_t in_size, const uint8_t *in, size_t &in_used,
+                                           size_t out_size, uint8_t *out) = 0;
+
+  /// false if we stopped in the middle of a member or frame, i.e. the input is truncated
+  virtual bool complete() const = 0;
+};
+
+/// Position of an independent piece of compressed data, e.g. a zstd frame
+struct Compressed_Frame final {
+  size_t offset;
+  size_t size;
+};
+
+/// Split zstd data that is completely in memory into its frames, which can be decompressed in parallel.
+/// Fails if zstd is not available or the data is corrupt.
+Result<std::vector<Compressed_Frame>, Error> zstd_frames(size_t size, const uint8_t *data);
+
+} // end namespace bc
@@ -0,0 +1,41 @@
+
+#include "error.hpp"
+#include <cctype> // std::isprint
+
+using namespace bc;
+
+std::string bc::escape(const std::string &txt) {
+  auto hexdigit = [](char C) {
+    return (C < 10) ? ('0' + C) : ('a' + C - 10);
+  };
+
+  std::string out;
+
+  for (unsigned char c : txt) {
+    switch (c) {
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '"':
+      out += "\\\"";
+      break;
+    default:
+      if (std::isprint(c)) {
+        out += c;
+      } else {
+        out += "\\x";
+        out += hexdigit((c >> 4) & 0xF);
+        out += hexdigit((c >> 0) & 0xF);
+      }
+      break;
+    }
+  }
+
+  return out;
+}
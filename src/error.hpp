@@ -0,0 +1,32 @@
+
+#pragma once
+
+#include "result.hpp"   // bc::Result
+#include <string>       // std::string
+#include <system_error> // std::error_code
+
+namespace bc {
+
+/// An error code plus a human readable description of what we were doing when it happened.
+struct Error final {
+  Error(std::error_code EC, const std::string &msg) : EC{EC}, msg{msg} {}
+
+  template<typename T>
+  Error(const Result<T, std::error_code> &R, const std::string &msg) {
+    assert(!R);
+    this->EC  = R.get_error();
+    this->msg = msg;
+  }
+
+  std::string message() const {
+    return msg + ": " + EC.message();
+  }
+
+  std::error_code EC;
+  std::string     msg;
+};
+
+/// escape non-printable characters in a string, e.g. for printing file names.
+std::string escape(const std::string &txt);
+
+} // end namespace bc
@@ -0,0 +1,781 @@
+
+#include "file_bit_counter.hpp"
+#include "bc_openmp.hpp"
+#include "on_exit.hpp"
+#include <algorithm>          // std::max, std::min
+#include <atomic>             // std::atomic
+#include <condition_variable> // std::condition_variable
+#include <cstring>            // memcpy
+#include <mutex>              // std::mutex, std::unique_lock
+#include <optional>           // std::optional
+#include <thread>             // std::thread
+#include <vector>             // std::vector
+
+using namespace bc;
+
+int bc::File_Bit_Counter::get_num_threads() const {
+  if (num_threads <= 0) {
+    return omp::max_threads();
+  }
+  return std::min(num_threads, omp::max_threads());
+}
+
+Result<Count, Error> bc::File_Bit_Counter::bitcount(const std::string &file) const {
+  return bitcount_file(file, nullptr);
+}
+
+Result<Count, Error> bc::File_Bit_Counter::bitcount(int fd, const std::string &name) const {
+  return bitcount_fd(fd, name, nullptr);
+}
+
+Result<Count, Error> bc::File_Bit_Counter::bitcount(const std::string &file, Bitcount_Buffer &buffer) const {
+  return bitcount_file(file, &buffer);
+}
+
+Result<Count, Error> bc::File_Bit_Counter::bitcount(int fd, const std::string &name, Bitcount_Buffer &buffer) const {
+  return bitcount_fd(fd, name, &buffer);
+}
+
+Result<Count, Error> bc::File_Bit_Counter::bitcount_file(const std::string &file, Bitcount_Buffer *buffer) const {
+  auto fd = sys::open(file);
+  if (!fd) {
+    return Error{fd, "could not open file " + escape(file)};
+  }
+  auto closer = on_exit([&](){ sys::close(*fd); });
+
+  return bitcount_fd(*fd, file, buffer);
+}
+
+Result<Count, Error> bc::File_Bit_Counter::bitcount_fd(int fd, const std::string &name, Bitcount_Buffer *buffer) const {
+  auto stat = sys::stat(fd);
+
+  /// Like streaming, count from the current position on (the fd may be stdin or passed to us half read)
+  /// and leave the position after what we counted. Only pipes & co have no position, and they stream anyway.
+  auto position = sys::tell(fd);
+
+  auto skip_counted = [&](const Result<Count, Error> &cnt) -> Result<Count, Error> {
+    if (cnt) {
+      auto sought = sys::seek(fd, *position + cnt->bits() / 8);
+      if (!sought) {
+        return Error{sought, "could not seek in file " + escape(name)};
+      }
+    }
+    return cnt;
+  };
+
+  /// mappings always start at the beginning of the file
+  if (stat && position && *position == 0 && should_mmap(*stat)) {
+    auto cnt = mmap_bitcount(fd, name, stat->size);
+    if (cnt) {
+      return skip_counted(cnt);
+    }
+  }
+
+  /// mmap failed or isn't wanted, read ranges in parallel if we know how big the file is
+  if (stat && position && should_pread(*stat)) {
+    auto cnt = pread_bitcount(fd, name, *position, stat->size);
+    if (cnt || cnt.get_error().EC != std::errc::invalid_seek) {
+      return skip_counted(cnt);
+    }
+  }
+
+  /// fall back to streaming if file is small or nothing else works
+  if (buffer) {
+    return stream_bitcount(fd, name, *buffer);
+  } else {
+    Bitcount_Buffer tmp = allocate_buffer();
+    return stream_bitcount(fd, name, tmp);
+  }
+}
+
+bool bc::File_Bit_Counter::should_mmap(sys::Stat stat) const {
+  // If this not a file or a block device (e.g. it's a named pipe
+  // or character device), we can't trust the size.
+  // Stream in chunk by chunk
+  if (stat.type != sys::Stat::REGULAR && stat.type != sys::Stat::BLOCK)
+    return false;
+
+  // don't mmap small files
+  if (stat.size < mmap_threshold || stat.size == 0) {
+    return false;
+  }
+
+  return true;
+}
+
+bool bc::File_Bit_Counter::should_pread(sys::Stat stat) const {
+  // same as for mmap, we need to trust the size
+  if (stat.type != sys::Stat::REGULAR && stat.type != sys::Stat::BLOCK)
+    return false;
+
+  // nested parallel regions only get one thread, streaming is just as good then
+  if (omp::in_parallel())
+    return false;
+
+  // only worth it if every thread gets something to do
+  return stat.size >= 2 * pread_range_size();
+}
+
+size_t bc::File_Bit_Counter::pread_range_size() const {
+  /// small reads don't keep the device queue busy, and each one costs a syscall
+  const size_t MIN_RANGE_SIZE = 1024 * 1024;
+
+  return std::max(chunk_size, MIN_RANGE_SIZE);
+}
+
+unsigned bc::File_Bit_Counter::mmap_flags() const {
+  unsigned flags = sys::MMAP_DEFAULT;
+  if (huge_pages) {
+    flags |= sys::MMAP_HUGE;
+  }
+  if (populate) {
+    flags |= sys::MMAP_POPULATE;
+  }
+  return flags;
+}
+
+Bitcount_Buffer bc::File_Bit_Counter::allocate_buffer(size_t size) const {
+  return huge_pages ? Bitcount_Buffer::allocate_huge(size) : Bitcount_Buffer::allocate(size);
+}
+
+Result<Count, Error> bc::File_Bit_Counter::stream_bitcount(int fd, const std::string &name, Bitcount_Buffer &buffer) const {
+  Count accum;
+
+  ssize_t bytes_read;
+  // read until we hit EOF.
+  do {
+    auto ret = sys::read(fd, chunk_size, buffer.get());
+
+    if (!ret) {
+      return Error{ret, "error reading file " + escape(name)};
+    } else {
+      bytes_read = ret.get_value();
+    }
+
+    const Count cnt = bc::bitcount(bytes_read, buffer.get(), kernel);
+    accum += cnt;
+
+    if (progress) {
+      progress->add(cnt);
+    }
+  } while (bytes_read != 0);
+
+  return accum;
+}
+
+Result<Count, Error> bc::File_Bit_Counter::mmap_bitcount(int fd, const std::string &name, size_t size) const {
+  auto mmap = sys::mmap(fd, size, mmap_flags());
+  if (!mmap) {
+    return Error{mmap, "could not mmap file " + escape(name)};
+  }
+  auto unmapper = on_exit([&]() { sys::munmap(*mmap, size); });
+
+  const uint8_t *data = (const uint8_t*) *mmap;
+
+  assert((uintptr_t(data) % 64 == 0) && "mmap returned unaligned data?");
+
+  if (!omp::in_parallel()) {
+    return numa ? numa->bitcount(size, data, kernel, progress) : bc::parallel_bitcount(size, data, kernel, progress);
+  }
+
+  if (!progress) {
+    Count accum = bc::bitcount(size, data, kernel);
+    return accum;
+  }
+
+  /// go piece by piece, so progress doesn't stall on big files
+  const size_t PIECE_SIZE = 16 * 1024 * 1024;
+
+  Count accum;
+  for (size_t bgn = 0; bgn < size; bgn += PIECE_SIZE) {
+    const Count cnt = bc::bitcount(std::min(PIECE_SIZE, size - bgn), data + bgn, kernel);
+    accum += cnt;
+    progress->add(cnt);
+  }
+  return accum;
+}
+
+Result<Count, Error> bc::File_Bit_Counter::pread_bitcount(int fd, const std::string &name, size_t offset, size_t size) const {
+  const size_t range_size = pread_range_size();
+  const size_t length     = size > offset ? size - offset : 0;
+  const long   num_ranges = long((length + range_size - 1) / range_size);
+
+  size_t num_ones  = 0;
+  size_t num_bytes = 0;
+
+  std::atomic<bool> failed{false};
+  std::error_code   err;
+
+  BC_OMP(parallel reduction(+: num_ones, num_bytes))
+  {
+    /// allocated by the thread using it, so it's node local with --numa
+    Bitcount_Buffer buffer = allocate_buffer(range_size);
+
+    BC_OMP(for schedule(dynamic))
+    for (long i = 0; i < num_ranges; i++) {
+      if (failed.load(std::memory_order_relaxed)) {
+        continue;
+      }
+
+      const size_t bgn = offset + size_t(i) * range_size;
+      const size_t len = std::min(range_size, size - bgn);
+
+      size_t done = 0;
+      while (done < len) {
+        auto ret = sys::pread(fd, len - done, bgn + done, buffer.get() + done);
+
+        if (!ret) {
+          BC_OMP(critical)
+          err = ret.get_error();
+
+          failed = true;
+          break;
+        }
+
+        /// file got shorter under our feet
+        if (*ret == 0) {
+          break;
+        }
+
+        done += *ret;
+      }
+
+      const Count cnt = bc::bitcount(done, buffer.get(), kernel);
+      num_ones  += cnt.ones;
+      num_bytes += done;
+
+      if (progress) {
+        progress->add(cnt);
+      }
+    }
+  }
+
+  if (failed) {
+    return Error{err, "error reading file " + escape(name)};
+  }
+
+  Count cnt;
+  cnt.ones   = num_ones;
+  cnt.zeroes = num_bytes * 8 - num_ones;
+  return cnt;
+}
+
+/// ***** tar archives
+
+Result<std::vector<Tar_Count>, Error> bc::File_Bit_Counter::bitcount_tar(const std::string &file) const {
+  return bitcount_tar_file(file, nullptr);
+}
+
+Result<std::vector<Tar_Count>, Error> bc::File_Bit_Counter::bitcount_tar(int fd, const std::string &name) const {
+  return bitcount_tar_fd(fd, name, nullptr);
+}
+
+Result<std::vector<Tar_Count>, Error> bc::File_Bit_Counter::bitcount_tar(const std::string &file, Bitcount_Buffer &buffer) const {
+  return bitcount_tar_file(file, &buffer);
+}
+
+Result<std::vector<Tar_Count>, Error> bc::File_Bit_Counter::bitcount_tar(int fd, const std::string &name, Bitcount_Buffer &buffer) const {
+  return bitcount_tar_fd(fd, name, &buffer);
+}
+
+Result<std::vector<Tar_Count>, Error> bc::File_Bit_Counter::bitcount_tar_file(const std::string &file, Bitcount_Buffer *buffer) const {
+  auto fd = sys::open(file);
+  if (!fd) {
+    return Error{fd, "could not open file " + escape(file)};
+  }
+  auto closer = on_exit([&](){ sys::close(*fd); });
+
+  return bitcount_tar_fd(*fd, file, buffer);
+}
+
+Result<std::vector<Tar_Count>, Error> bc::File_Bit_Counter::bitcount_tar_fd(int fd, const std::string &name, Bitcount_Buffer *buffer) const {
+  auto stat = sys::stat(fd);
+
+  if (stat && (stat->type == sys::Stat::REGULAR || stat->type == sys::Stat::BLOCK) && stat->size > 0) {
+    auto mmap = sys::mmap(fd, stat->size, mmap_flags());
+
+    if (mmap) {
+      auto unmapper = on_exit([&]() { sys::munmap(*mmap, stat->size); });
+
+      return mmap_bitcount_tar(name, stat->size, (const uint8_t*) *mmap);
+    }
+  }
+
+  /// fall back to streaming for pipes or if mmaping fails
+  if (buffer) {
+    return stream_bitcount_tar(fd, name, *buffer);
+  } else {
+    Bitcount_Buffer tmp = allocate_buffer();
+    return stream_bitcount_tar(fd, name, tmp);
+  }
+}
+
+Result<std::vector<Tar_Count>, Error>
+bc::File_Bit_Counter::mmap_bitcount_tar(const std::string &name, size_t size, const uint8_t *data) const {
+  auto members = tar_members(size, data);
+  if (!members) {
+    return Error{members.get_error().EC, escape(name) + ": " + members.get_error().msg};
+  }
+
+  /// Cut members into pieces, so big members get split across threads too.
+  /// Payloads start at 512 byte offsets in a page aligned mapping, so pieces stay aligned for bitcount().
+  const size_t PIECE_SIZE = 4 * 1024 * 1024;
+
+  struct Piece final {
+    size_t member;
+    size_t offset;
+    size_t size;
+  };
+
+  std::vector<Piece> pieces;
+  for (size_t i = 0; i < members->size(); i++) {
+    const Tar_Member &member = (*members)[i];
+
+    for (size_t offset = 0; offset < member.size; offset += PIECE_SIZE) {
+      pieces.push_back(Piece{i, member.offset + offset, std::min(PIECE_SIZE, member.size - offset)});
+    }
+  }
+
+  std::vector<std::atomic<size_t>> ones(members->size());
+  for (auto &cnt : ones) {
+    cnt.store(0, std::memory_order_relaxed);
+  }
+
+  BC_OMP(parallel for schedule(dynamic))
+  for (long i = 0; i < long(pieces.size()); i++) {
+    const Piece &piece = pieces[i];
+
+    const Count cnt = bc::bitcount(piece.size, data + piece.offset, kernel);
+    ones[piece.member].fetch_add(cnt.ones, std::memory_order_relaxed);
+
+    if (progress) {
+      progress->add(cnt);
+    }
+  }
+
+  std::vector<Tar_Count> out;
+  for (size_t i = 0; i < members->size(); i++) {
+    const Tar_Member &member = (*members)[i];
+
+    Count cnt;
+    cnt.ones   = ones[i].load(std::memory_order_relaxed);
+    cnt.zeroes = member.size * 8 - cnt.ones;
+
+    out.push_back(Tar_Count{member.name, cnt});
+  }
+  return out;
+}
+
+/// read until buffer is full or we hit EOF, returns the number of bytes read
+static Result<size_t, std::error_code> read_full(int fd, size_t size, uint8_t *buffer) {
+  size_t done = 0;
+
+  while (done < size) {
+    auto ret = sys::read(fd, size - done, buffer + done);
+    if (!ret) {
+      return ret.get_error();
+    }
+    if (*ret == 0) {
+      break;
+    }
+    done += *ret;
+  }
+
+  return done;
+}
+
+Result<std::vector<Tar_Count>, Error> bc::File_Bit_Counter::stream_bitcount_tar(int fd, const std::string &name,
+                                                                                Bitcount_Buffer &buffer) const {
+  Tar_Parser parser;
+
+  alignas(64) uint8_t header[TAR_BLOCK_SIZE];
+
+  auto truncated = [&]() {
+    return Error{std::make_error_code(std::errc::invalid_argument), escape(name) + ": truncated tar archive"};
+  };
+
+  std::vector<Tar_Count> out;
+
+  while (true) {
+    auto got = read_full(fd, TAR_BLOCK_SIZE, header);
+    if (!got) {
+      return Error{got, "error reading file " + escape(name)};
+    }
+
+    /// archives that stop without end blocks are fine, archives that stop in the middle of a header are not
+    if (*got == 0) {
+      break;
+    }
+    if (*got < TAR_BLOCK_SIZE) {
+      return truncated();
+    }
+
+    auto action = parser.header(header);
+    if (!action) {
+      return Error{action.get_error().EC, escape(name) + ": " + action.get_error().msg};
+    }
+
+    if (*action == Tar_Parser::END) {
+      /// drain the rest (more end blocks & padding), so whoever is writing into our pipe doesn't get EPIPE
+      do {
+        got = read_full(fd, TAR_BLOCK_SIZE, header);
+      } while (got && *got == TAR_BLOCK_SIZE);
+      break;
+    }
+
+    Count       cnt;
+    std::string meta;
+
+    for (size_t remaining = parser.size(); remaining > 0;) {
+      const size_t want = std::min(chunk_size, remaining);
+
+      auto ret = read_full(fd, want, buffer.get());
+      if (!ret) {
+        return Error{ret, "error reading file " + escape(name)};
+      }
+      if (*ret < want) {
+        return truncated();
+      }
+
+      if (*action == Tar_Parser::COUNT) {
+        const Count c = bc::bitcount(want, buffer.get(), kernel);
+        cnt += c;
+
+        if (progress) {
+          progress->add(c);
+        }
+      } else if (*action == Tar_Parser::READ_META) {
+        meta.append((const char*) buffer.get(), want);
+      }
+
+      remaining -= want;
+    }
+
+    const size_t padding = tar_padded_size(parser.size()) - parser.size();
+
+    got = read_full(fd, padding, header);
+    if (!got) {
+      return Error{got, "error reading file " + escape(name)};
+    }
+    if (*got < padding) {
+      return truncated();
+    }
+
+    if (*action == Tar_Parser::COUNT) {
+      out.push_back(Tar_Count{parser.name(), cnt});
+    } else if (*action == Tar_Parser::READ_META) {
+      parser.meta(meta);
+    }
+  }
+
+  return out;
+}
+
+/// ***** compressed files
+
+Result<Count, Error> bc::File_Bit_Counter::bitcount_decompressed(const std::string &file) const {
+  return bitcount_decompressed_file(file, nullptr);
+}
+
+Result<Count, Error> bc::File_Bit_Counter::bitcount_decompressed(int fd, const std::string &name) const {
+  return bitcount_decompressed_fd(fd, name, nullptr);
+}
+
+Result<Count, Error> bc::File_Bit_Counter::bitcount_decompressed(const std::string &file, Bitcount_Buffer &buffer) const {
+  return bitcount_decompressed_file(file, &buffer);
+}
+
+Result<Count, Error> bc::File_Bit_Counter::bitcount_decompressed(int fd, const std::string &name, Bitcount_Buffer &buffer) const {
+  return bitcount_decompressed_fd(fd, name, &buffer);
+}
+
+Result<Count, Error> bc::File_Bit_Counter::bitcount_decompressed_file(const std::string &file, Bitcount_Buffer *buffer) const {
+  auto fd = sys::open(file);
+  if (!fd) {
+    return Error{fd, "could not open file " + escape(file)};
+  }
+  auto closer = on_exit([&](){ sys::close(*fd); });
+
+  return bitcount_decompressed_fd(*fd, file, buffer);
+}
+
+Result<Count, Error> bc::File_Bit_Counter::bitcount_decompressed_fd(int fd, const std::string &name, Bitcount_Buffer *buffer) const {
+  auto stat = sys::stat(fd);
+
+  alignas(64) uint8_t magic[COMPRESSION_MAGIC_SIZE];
+
+  auto position = sys::tell(fd);
+
+  /// only allocate a buffer if we need one and the caller has none for us
+  std::optional<Bitcount_Buffer> own;
+  auto get_buffer = [&]() -> Bitcount_Buffer& {
+    if (!buffer) {
+      own.emplace(allocate_buffer());
+      buffer = &*own;
+    }
+    return *buffer;
+  };
+
+  if (stat && position && (stat->type == sys::Stat::REGULAR || stat->type == sys::Stat::BLOCK)) {
+    /// peek without moving the file offset, so whoever reads the file next sees all of it
+    auto got = sys::pread(fd, sizeof(magic), *position, magic);
+    if (!got) {
+      return Error{got, "error reading file " + escape(name)};
+    }
+
+    const Compression compression = detect_compression(*got, magic);
+    if (compression == Compression::NONE) {
+      return bitcount_fd(fd, name, buffer);
+    }
+
+    /// zstd frames are independent, if there are several of them every thread can take some
+    if (compression == Compression::ZSTD && compression_available(compression) && *position == 0 && !omp::in_parallel()) {
+      auto mmap = sys::mmap(fd, stat->size, mmap_flags());
+
+      if (mmap) {
+        auto unmapper = on_exit([&]() { sys::munmap(*mmap, stat->size); });
+
+        const uint8_t *data = (const uint8_t*) *mmap;
+
+        auto frames = zstd_frames(stat->size, data);
+        if (!frames) {
+          return Error{frames.get_error().EC, escape(name) + ": " + frames.get_error().msg};
+        }
+
+        if (frames->size() > 1) {
+          return mmap_bitcount_zstd(name, data, *frames);
+        }
+      }
+    }
+
+    return pipelined_bitcount(fd, name, compression, 0, nullptr, get_buffer());
+  }
+
+  /// we can't put what we read back into a pipe, so it is passed on to whoever counts the rest
+  auto got = read_full(fd, sizeof(magic), magic);
+  if (!got) {
+    return Error{got, "error reading file " + escape(name)};
+  }
+
+  const Compression compression = detect_compression(*got, magic);
+  if (compression != Compression::NONE) {
+    return pipelined_bitcount(fd, name, compression, *got, magic, get_buffer());
+  }
+
+  const Count cnt = bc::bitcount(*got, magic, kernel);
+  if (progress) {
+    progress->add(cnt);
+  }
+
+  auto rest = stream_bitcount(fd, name, get_buffer());
+  if (!rest) {
+    return rest;
+  }
+  return cnt + *rest;
+}
+
+Result<Count, Error> bc::File_Bit_Counter::pipelined_bitcount(int fd, const std::string &name, Compression compression,
+                                                              size_t prefix_size, const uint8_t *prefix, Bitcount_Buffer &in) const {
+  auto decompressor = Decompressor::create(compression);
+  if (!decompressor) {
+    return Error{decompressor.get_error().EC, escape(name) + ": " + decompressor.get_error().msg};
+  }
+
+  /// same trade off as for pread ranges: big enough that handing buffers over is cheap
+  const size_t out_size = pread_range_size();
+
+  /// these only live as long as this file, huge pages would cost more to map than they save
+  Bitcount_Buffer buffers[2] = {Bitcount_Buffer::allocate(out_size), Bitcount_Buffer::allocate(out_size)};
+
+  /// buffers go back and forth between the threads, always in the same order
+  struct Slot final {
+    size_t size = 0;
+    bool   full = false;
+  };
+
+  std::mutex              mutex;
+  std::condition_variable cond;
+  Slot                    slots[2];
+  bool                    done = false;
+  std::optional<Error>    error;
+
+  std::thread decompressing{[&]() {
+    memcpy(in.get(), prefix, prefix_size);
+
+    size_t in_size = prefix_size;
+    size_t in_used = 0;
+    bool   eof     = false;
+
+    std::optional<Error> failure;
+
+    for (size_t i = 0;; i ^= 1) {
+      {
+        std::unique_lock<std::mutex> lock{mutex};
+        cond.wait(lock, [&]() { return !slots[i].full; });
+      }
+
+      size_t filled = 0;
+      while (filled < out_size) {
+        if (in_used == in_size && !eof) {
+          auto ret = sys::read(fd, chunk_size, in.get());
+          if (!ret) {
+            failure = Error{ret, "error reading file " + escape(name)};
+            break;
+          }
+
+          in_size = size_t(*ret);
+          in_used = 0;
+          eof     = *ret == 0;
+        }
+
+        const size_t in_before = in_used;
+
+        auto got = decompressor.get_value()->decompress(in_size, in.get(), in_used, out_size - filled, buffers[i].get() + filled);
+        if (!got) {
+          failure = Error{got.get_error().EC, escape(name) + ": " + got.get_error().msg};
+          break;
+        }
+        filled += *got;
+
+        /// nothing left to read, and everything we read is decompressed
+        if (eof && *got == 0) {
+          break;
+        }
+
+        /// Decompressors keep partial input themselves, so if one takes nothing and gives nothing
+        /// although there is input and room for output, it never will. Don't spin on it.
+        if (*got == 0 && in_used == in_before && in_used < in_size) {
+          failure = Error{std::make_error_code(std::errc::invalid_argument),
+                          escape(name) + ": " + compression_name(compression) + " decompression is stuck, corrupt data?"};
+          break;
+        }
+      }
+
+      const bool last = failure || filled < out_size;
+
+      if (last && !failure && !decompressor.get_value()->complete()) {
+        failure = Error{std::make_error_code(std::errc::invalid_argument),
+                        escape(name) + ": truncated " + compression_name(compression) + " data"};
+      }
+
+      {
+        std::lock_guard<std::mutex> lock{mutex};
+        slots[i].size = filled;
+        slots[i].full = true;
+
+        if (last) {
+          done  = true;
+          error = std::move(failure);
+        }
+      }
+      cond.notify_all();
+
+      if (last) {
+        break;
+      }
+    }
+  }};
+
+  Count accum;
+
+  for (size_t i = 0;; i ^= 1) {
+    size_t size;
+    {
+      std::unique_lock<std::mutex> lock{mutex};
+      cond.wait(lock, [&]() { return slots[i].full || done; });
+
+      if (!slots[i].full) {
+        break;
+      }
+      size = slots[i].size;
+    }
+
+    const Count cnt = bc::bitcount(size, buffers[i].get(), kernel);
+    accum += cnt;
+
+    if (progress) {
+      progress->add(cnt);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      slots[i].full = false;
+    }
+    cond.notify_all();
+  }
+
+  decompressing.join();
+
+  if (error) {
+    return *error;
+  }
+  return accum;
+}
+
+Result<Count, Error> bc::File_Bit_Counter::mmap_bitcount_zstd(const std::string &name, const uint8_t *data,
+                                                              const std::vector<Compressed_Frame> &frames) const {
+  const size_t out_size = pread_range_size();
+
+  size_t num_ones  = 0;
+  size_t num_bytes = 0;
+
+  std::atomic<bool>    failed{false};
+  std::optional<Error> error;
+
+  BC_OMP(parallel reduction(+: num_ones, num_bytes))
+  {
+    /// per file and thread, so not from huge pages either
+    Bitcount_Buffer buffer       = Bitcount_Buffer::allocate(out_size);
+    auto            decompressor = Decompressor::create(Compression::ZSTD);
+
+    BC_OMP(for schedule(dynamic))
+    for (long i = 0; i < long(frames.size()); i++) {
+      if (failed.load(std::memory_order_relaxed)) {
+        continue;
+      }
+
+      auto fail = [&](const Error &err) {
+        BC_OMP(critical)
+        error = Error{err.EC, escape(name) + ": " + err.msg};
+
+        failed = true;
+      };
+
+      if (!decompressor) {
+        fail(decompressor.get_error());
+        continue;
+      }
+
+      const Compressed_Frame &frame = frames[i];
+
+      size_t used = 0;
+      while (true) {
+        auto got = decompressor.get_value()->decompress(frame.size, data + frame.offset, used, out_size, buffer.get());
+        if (!got) {
+          fail(got.get_error());
+          break;
+        }
+        if (*got == 0) {
+          break;
+        }
+
+        const Count cnt = bc::bitcount(*got, buffer.get(), kernel);
+        num_ones  += cnt.ones;
+        num_bytes += *got;
+
+        if (progress) {
+          progress->add(cnt);
+        }
+      }
+    }
+  }
+
+  if (failed) {
+    return *error;
+  }
+
+  Count cnt;
+  cnt.ones   = num_ones;
+  cnt.zeroes = num_bytes * 8 - num_ones;
+  return cnt;
+}
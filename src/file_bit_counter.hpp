@@ -0,0 +1,129 @@
+
+#pragma once
+
+#include "bitcnt.hpp"     // bc::Count, bc::Bitcount_Buffer
+#include "decompress.hpp" // bc::Compression, bc::Compressed_Frame
+#include "error.hpp"      // bc::Error
+#include "numa.hpp"       // bc::Numa
+#include "progress.hpp"   // bc::Progress
+#include "result.hpp"     // bc::Result
+#include "sys.hpp"        // bc::sys::Stat
+#include "tar.hpp"        // bc::Tar_Count
+#include "tuning.hpp"     // bc::Tuning
+#include <string>         // std::string
+#include <vector>         // std::vector
+
+namespace bc {
+
+/// Counts bits in files, using mmap where possible and streaming otherwise.
+struct File_Bit_Counter final {
+  explicit File_Bit_Counter(size_t chunk_size)
+  : chunk_size{chunk_size}, mmap_threshold{chunk_size}, kernel{DEFAULT_KERNEL}, num_threads{0},
+    huge_pages{false}, populate{false}, numa{nullptr}, progress{nullptr} {}
+
+  /// Files counted outside of a parallel region are split across the whole OpenMP team.
+  /// If numa is given, mmapped files are split node by node.
+  /// If progress is given, every chunk we count is added to it.
+  explicit File_Bit_Counter(const Tuning &tuning, const Numa *numa = nullptr, Progress *progress = nullptr)
+  : chunk_size{tuning.chunk_size}, mmap_threshold{tuning.mmap_threshold}, kernel{tuning.kernel},
+    num_threads{tuning.num_threads}, huge_pages{tuning.huge_pages}, populate{tuning.populate}, numa{numa}, progress{progress} {}
+
+  Result<Count, Error> bitcount(const std::string &file) const;
+
+  Result<Count, Error> bitcount(int fd, const std::string &name) const;
+
+  /// Same as above, but streams through a caller provided buffer of at least chunk_size bytes
+  /// instead of allocating a new one for every file.
+  Result<Count, Error> bitcount(const std::string &file, Bitcount_Buffer &buffer) const;
+
+  Result<Count, Error> bitcount(int fd, const std::string &name, Bitcount_Buffer &buffer) const;
+
+  /// Count every regular file in a tar archive, straight from the archive without extracting anything.
+  /// The archive is mapped if possible, and streamed otherwise.
+  Result<std::vector<Tar_Count>, Error> bitcount_tar(const std::string &file) const;
+
+  Result<std::vector<Tar_Count>, Error> bitcount_tar(int fd, const std::string &name) const;
+
+  /// Same as above, but streams through a caller provided buffer of at least chunk_size bytes.
+  Result<std::vector<Tar_Count>, Error> bitcount_tar(const std::string &file, Bitcount_Buffer &buffer) const;
+
+  Result<std::vector<Tar_Count>, Error> bitcount_tar(int fd, const std::string &name, Bitcount_Buffer &buffer) const;
+
+  /// Same as bitcount(), but gzip and zstd input (going by its magic bytes) is counted as it is decompressed.
+  /// Anything else is counted as is.
+  Result<Count, Error> bitcount_decompressed(const std::string &file) const;
+
+  Result<Count, Error> bitcount_decompressed(int fd, const std::string &name) const;
+
+  /// Same as above, but reads and streams through a caller provided buffer of at least chunk_size bytes.
+  Result<Count, Error> bitcount_decompressed(const std::string &file, Bitcount_Buffer &buffer) const;
+
+  Result<Count, Error> bitcount_decompressed(int fd, const std::string &name, Bitcount_Buffer &buffer) const;
+
+  size_t get_chunk_size() const { return chunk_size; }
+
+  bool get_huge_pages() const { return huge_pages; }
+
+  /// How many threads should count separate files at the same time (Tuning::num_threads).
+  /// Never more than the OpenMP team, so per-thread buffers for the whole team are always enough.
+  int get_num_threads() const;
+
+  /// a stream buffer of chunk_size bytes, backed by huge pages if we are tuned to use them
+  Bitcount_Buffer allocate_buffer() const { return allocate_buffer(chunk_size); }
+private:
+  /// buffer may be null, then we allocate one if we need it.
+  Result<Count, Error> bitcount_file(const std::string &file, Bitcount_Buffer *buffer) const;
+  Result<Count, Error> bitcount_fd(int fd, const std::string &name, Bitcount_Buffer *buffer) const;
+  Result<std::vector<Tar_Count>, Error> bitcount_tar_file(const std::string &file, Bitcount_Buffer *buffer) const;
+  Result<std::vector<Tar_Count>, Error> bitcount_tar_fd(int fd, const std::string &name, Bitcount_Buffer *buffer) const;
+  Result<Count, Error> bitcount_decompressed_file(const std::string &file, Bitcount_Buffer *buffer) const;
+  Result<Count, Error> bitcount_decompressed_fd(int fd, const std::string &name, Bitcount_Buffer *buffer) const;
+
+  bool should_mmap(sys::Stat stat) const;
+
+  bool should_pread(sys::Stat stat) const;
+
+  /// read stream in chunk by chunk and do popcount of each chunk
+  Result<Count, Error> stream_bitcount(int fd, const std::string &name, Bitcount_Buffer &buffer) const;
+
+  /// mmap file in one go and do popcount
+  Result<Count, Error> mmap_bitcount(int fd, const std::string &name, size_t size) const;
+
+  /// all threads of the OpenMP team pread disjoint ranges of the file from offset on into their own buffers.
+  /// Unlike streaming this stops at the size the file had when we looked at it, and doesn't move the file position.
+  Result<Count, Error> pread_bitcount(int fd, const std::string &name, size_t offset, size_t size) const;
+
+  /// size of the ranges for pread_bitcount, at least chunk_size
+  size_t pread_range_size() const;
+
+  Bitcount_Buffer allocate_buffer(size_t size) const;
+
+  /// sys::Mmap_Flags we are tuned for
+  unsigned mmap_flags() const;
+
+  /// count the members of a mapped tar archive, in parallel
+  Result<std::vector<Tar_Count>, Error> mmap_bitcount_tar(const std::string &name, size_t size, const uint8_t *data) const;
+
+  /// read a tar archive header by header, member by member
+  Result<std::vector<Tar_Count>, Error> stream_bitcount_tar(int fd, const std::string &name, Bitcount_Buffer &buffer) const;
+
+  /// Decompress on a second thread into one buffer while we count the other one.
+  /// prefix is what we already read from fd to detect the format, in is where we read compressed data to.
+  Result<Count, Error> pipelined_bitcount(int fd, const std::string &name, Compression compression,
+                                          size_t prefix_size, const uint8_t *prefix, Bitcount_Buffer &in) const;
+
+  /// decompress & count the frames of a mapped zstd file in parallel
+  Result<Count, Error> mmap_bitcount_zstd(const std::string &name, const uint8_t *data,
+                                          const std::vector<Compressed_Frame> &frames) const;
+
+  const size_t chunk_size;
+  const size_t mmap_threshold;
+  const Kernel kernel;
+  const int    num_threads;
+  const bool   huge_pages;
+  const bool   populate;
+  const Numa  *numa;
+  Progress    *progress;
+};
+
+} // end namespace bc
@@ -1,31 +1,26 @@
 
 #include "bitcnt.hpp"
+#include "error.hpp"
+#include "file_bit_counter.hpp"
+#include "numa.hpp"
+#include "progress.hpp"
+#include "on_exit.hpp"
 #include "result.hpp"
+#include "server.hpp"
 #include "sys.hpp"
+#include "tuning.hpp"
 #include "bc_openmp.hpp"
 #include <cstdio>       // printf
-#include <memory>       // unique_ptr
-#include <system_error> // std::error_code
+#include <cstdlib>      // getenv, strtoull, strtod
+#include <cstring>      // strcmp
+#include <functional>   // std::function
+#include <limits>       // std::numeric_limits
+#include <optional>     // std::optional
+#include <string>       // std::string
+#include <vector>       // std::vector
 
 using namespace bc;
 
-/// RAII helper, runs a piece of code on scope exit
-template<typename Fn>
-struct On_Exit final {
-  On_Exit(Fn &&fn) : fn{fn} {}
-
-  ~On_Exit() {
-    fn();
-  }
-private:
-  Fn fn;
-};
-
-template<typename Fn>
-auto on_exit(Fn &&fn) {
-  return On_Exit<Fn>(std::forward<Fn>(fn));
-}
-
 void print_count(Count cnt, const std::string &filename) {
   const double KILO = 1'000;
   const double MEGA = 1'000'000;
@@ -52,157 +47,318 @@ void print_count(Count cnt, const std::string &filename) {
     filename.c_str());
 }
 
-struct Error final {
-  Error(std::error_code EC, const std::string &msg) : EC{EC}, msg{msg} {}
+struct Options final {
+  enum Mode {
+    COUNT,  /// count files in this process
+    SERVE,  /// run a bitcount server
+    CLIENT, /// send files to a bitcount server
+    TUNE,   /// measure the best tuning for this machine
+  };
 
-  template<typename T>
-  Error(const Result<T, std::error_code> &R, const std::string &msg) {
-    assert(!R);
-    this->EC  = R.get_error();
-    this->msg = msg;
-  }
+  Mode                     mode = COUNT;
+  bool                     help = false;
+  std::string              socket_path;
+  bool                     pass_fds = false;
+  bool                     numa = false;
+  bool                     no_mmap = false;
+  bool                     huge_pages = false;
+  bool                     populate = false;
+  bool                     tar = false;
+  bool                     decompress = false;
+  double                   progress_interval = 0;
+  bool                     partial = true;
+  std::string              progress_file;
+  std::string              scratch_dir;
+  size_t                   scratch_size = 256 * 1024 * 1024;
+  std::vector<std::string> files;
+};
 
-  std::string message() const {
-    return msg + ": " + EC.message();
-  }
+static void print_usage(FILE *out, const char *argv0) {
+  fprintf(out,
+    "usage: %s [--tar | --decompress] [--numa] [--no-mmap] [--huge-pages] [--populate]\n"
+    "       %*s [--progress SECS] [--progress-file FILE] [--no-partial] [FILE...]\n"
+    "       %s --serve SOCKET\n"
+    "       %s --client SOCKET [--pass-fds] [FILE...]\n"
+    "       %s --autotune [--scratch-dir DIR] [--scratch-size MB]\n"
+    "\n"
+    "Count one and zero bits in FILEs (or stdin).\n"
+    "Settings are read from the tuning file $BC_TUNING_FILE, or ~/.bitcounter-tuning.\n"
+    "Send SIGUSR1 for a progress report, on SIGINT the counts so far are printed (unless --no-partial).\n"
+    "\n"
+    "  --tar            FILEs are tar archives, count every file in them\n"
+    "  --decompress     count what is in gzip and zstd compressed FILEs, others as they are\n"
+    "  --numa           pin threads to NUMA nodes and count big files node by node\n"
+    "  --no-mmap        never mmap FILEs, read them with pread instead\n"
+    "  --huge-pages     use 2 MiB pages for buffers and mappings, if possible\n"
+    "  --populate       fault in mappings up front instead of page by page\n"
+    "  --progress SECS  report progress every SECS seconds\n"
+    "  --progress-file  append progress reports to FILE instead of stderr\n"
+    "  --no-partial     don't catch SIGUSR1 and SIGINT, i.e. no reports or counts so far\n"
+    "  --serve SOCKET   keep running and count files for clients connecting to SOCKET\n"
+    "  --client SOCKET  let the server listening on SOCKET count FILEs\n"
+    "  --pass-fds       open FILEs here and pass the file descriptors to the server\n"
+    "  --autotune       benchmark this machine and write the tuning file\n"
+    "  --scratch-dir    where --autotune creates its scratch file (default: $TMPDIR or /tmp)\n"
+    "  --scratch-size   size of the scratch file in MB (default: 256)\n"
+    "  --               treat all following arguments as FILEs\n",
+    argv0, int(strlen(argv0)), "", argv0, argv0, argv0);
+}
 
-  std::error_code EC;
-  std::string     msg;
-};
+static std::optional<Options> parse_args(int argc, const char *const *argv) {
+  Options opts;
 
-static std::string escape(const std::string &txt) {
-  auto hexdigit = [](char C) {
-    return (C < 10) ? ('0' + C) : ('a' + C - 10);
-  };
+  bool only_files = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+
+    if (only_files || arg[0] != '-' || arg[1] == '\0') {
+      opts.files.push_back(arg);
+    } else if (!strcmp(arg, "--")) {
+      only_files = true;
+    } else if (!strcmp(arg, "--serve") || !strcmp(arg, "--client")) {
+      if (i + 1 == argc) {
+        fprintf(stderr, "error: %s needs an argument\n", arg);
+        return std::nullopt;
+      }
+
+      opts.mode        = !strcmp(arg, "--serve") ? Options::SERVE : Options::CLIENT;
+      opts.socket_path = argv[++i];
+    } else if (!strcmp(arg, "--pass-fds")) {
+      opts.pass_fds = true;
+    } else if (!strcmp(arg, "--tar")) {
+      opts.tar = true;
+    } else if (!strcmp(arg, "--decompress")) {
+      opts.decompress = true;
+    } else if (!strcmp(arg, "--numa")) {
+      opts.numa = true;
+    } else if (!strcmp(arg, "--no-mmap")) {
+      opts.no_mmap = true;
+    } else if (!strcmp(arg, "--progress") || !strcmp(arg, "--progress-file")) {
+      if (i + 1 == argc) {
+        fprintf(stderr, "error: %s needs an argument\n", arg);
+        return std::nullopt;
+      }
 
-  std::string out;
-
-  for (unsigned char c : txt) {
-    switch (c) {
-    case '\\':
-      out += "\\\\";
-      break;
-    case '\t':
-      out += "\\t";
-      break;
-    case '\n':
-      out += "\\n";
-      break;
-    case '"':
-      out += "\\\"";
-      break;
-    default:
-      if (std::isprint(c)) {
-        out += c;
+      if (!strcmp(arg, "--progress-file")) {
+        opts.progress_file = argv[++i];
       } else {
-        out += "\\x";
-        out += hexdigit((c >> 4) & 0xF);
-        out += hexdigit((c >> 0) & 0xF);
+        char *end = nullptr;
+        opts.progress_interval = strtod(argv[++i], &end);
+
+        if (*end != '\0' || !(opts.progress_interval > 0)) {
+          fprintf(stderr, "error: invalid progress interval %s\n", argv[i]);
+          return std::nullopt;
+        }
       }
-      break;
+    } else if (!strcmp(arg, "--no-partial")) {
+      opts.partial = false;
+    } else if (!strcmp(arg, "--huge-pages")) {
+      opts.huge_pages = true;
+    } else if (!strcmp(arg, "--populate")) {
+      opts.populate = true;
+    } else if (!strcmp(arg, "--autotune")) {
+      opts.mode = Options::TUNE;
+    } else if (!strcmp(arg, "--scratch-dir") || !strcmp(arg, "--scratch-size")) {
+      if (i + 1 == argc) {
+        fprintf(stderr, "error: %s needs an argument\n", arg);
+        return std::nullopt;
+      }
+
+      if (!strcmp(arg, "--scratch-dir")) {
+        opts.scratch_dir = argv[++i];
+      } else {
+        char *end = nullptr;
+        const size_t mb = strtoull(argv[++i], &end, 10);
+
+        if (*end != '\0' || mb == 0) {
+          fprintf(stderr, "error: invalid scratch size %s\n", argv[i]);
+          return std::nullopt;
+        }
+        opts.scratch_size = mb * 1024 * 1024;
+      }
+    } else if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+      opts.help = true;
+      return opts;
+    } else {
+      fprintf(stderr, "error: unknown option %s\n", arg);
+      return std::nullopt;
     }
   }
 
-  return out;
+  if ((opts.mode == Options::SERVE || opts.mode == Options::TUNE) && !opts.files.empty()) {
+    fprintf(stderr, "error: --serve and --autotune do not take any FILEs\n");
+    return std::nullopt;
+  }
+
+  if (opts.pass_fds && opts.mode != Options::CLIENT) {
+    fprintf(stderr, "error: --pass-fds only works with --client\n");
+    return std::nullopt;
+  }
+
+  /// the server only counts plain files
+  if ((opts.tar || opts.decompress) && (opts.mode == Options::CLIENT || opts.mode == Options::SERVE)) {
+    fprintf(stderr, "error: --tar and --decompress don't work with --serve or --client\n");
+    return std::nullopt;
+  }
+
+  if (opts.tar && opts.decompress) {
+    fprintf(stderr, "error: --tar and --decompress can't be combined\n");
+    return std::nullopt;
+  }
+
+  /// a progress file without reports would be a bit pointless
+  if (!opts.progress_file.empty() && opts.progress_interval == 0) {
+    opts.progress_interval = 10;
+  }
+
+  if (opts.scratch_dir.empty()) {
+    const char *tmp = getenv("TMPDIR");
+    opts.scratch_dir = tmp ? tmp : "/tmp";
+  }
+
+  return opts;
 }
 
-struct File_Bit_Counter final {
-  explicit File_Bit_Counter(size_t chunk_size) : chunk_size{chunk_size} {}
+/// Files at least this big are counted one by one, split across all threads (and NUMA nodes with --numa).
+/// Smaller ones are counted in parallel, one file per thread.
+static constexpr size_t SPLIT_SIZE = 64 * 1024 * 1024;
 
-  Result<Count, Error>
-  bitcount(const std::string &file) const {
-    auto fd = sys::open(file);
-    if (!fd) {
-      return Error{fd, "could not open file " + escape(file)};
-    }
-    auto closer = on_exit([&](){ sys::close(*fd); });
+/// size of a file or block device, nothing if it has none we can trust
+static std::optional<size_t> file_size(int fd) {
+  auto stat = sys::stat(fd);
+
+  if (stat && (stat->type == sys::Stat::REGULAR || stat->type == sys::Stat::BLOCK)) {
+    return stat->size;
+  }
+  return std::nullopt;
+}
 
-    return bitcount(*fd, file);
+static std::optional<size_t> file_size(const std::string &filename) {
+  auto fd = sys::open(filename);
+  if (!fd) {
+    return std::nullopt;
   }
+  auto closer = on_exit([&]() { sys::close(*fd); });
 
-  Result<Count, Error>
-  bitcount(int fd, const std::string &name) const {
-    auto stat = sys::stat(fd);
+  return file_size(*fd);
+}
 
-    if (stat && should_mmap(*stat)) {
-      auto cnt = mmap_bitcount(fd, name, stat->size);
-      if (cnt) {
-        return *cnt;
-      }
+/// Count every file in tar archives, one archive at a time.
+/// Members are printed as ARCHIVE:MEMBER.
+static int count_tar_files(const File_Bit_Counter &files, const std::vector<std::string> &archives) {
+  /// archives that can't be mapped are streamed, all through the same buffer
+  Bitcount_Buffer buffer = files.allocate_buffer();
+
+  Count  total;
+  size_t num_members = 0;
+
+  auto count_archive = [&](auto &&result, const std::string &archive) {
+    if (!result) {
+      fprintf(stderr, "error: %s\n", result.get_error().message().c_str());
+      return;
     }
 
-    /// fall back to streaming if file is small or mmaping fails
-    return stream_bitcount(fd, name);
+    for (const Tar_Count &member : *result) {
+      print_count(member.count, archive + ":" + member.name);
+      total += member.count;
+      num_members++;
+    }
+  };
+
+  if (archives.empty()) {
+    count_archive(files.bitcount_tar(0, "<stdin>", buffer), "<stdin>");
   }
-private:
-  bool should_mmap(sys::Stat stat) const {
-    // If this not a file or a block device (e.g. it's a named pipe
-    // or character device), we can't trust the size.
-    // Stream in chunk by chunk
-    if (stat.type != sys::Stat::REGULAR && stat.type != sys::Stat::BLOCK)
-      return false;
 
-    // don't mmap small files
-    if (stat.size < chunk_size) {
-      return false;
-    }
+  for (const std::string &archive : archives) {
+    count_archive(files.bitcount_tar(archive, buffer), archive);
+  }
 
-    return true;
+  if (num_members > 1) {
+    print_count(total, "<total>");
   }
 
-  /// read stream in chunk by chunk and do popcount of each chunk
-  Result<Count, Error> stream_bitcount(int fd, const std::string &name) const {
-    Bitcount_Buffer buffer = Bitcount_Buffer::allocate(chunk_size);
+  return 0;
+}
 
-    Count accum;
+static int count_files(const Tuning &tuning, const Numa *numa, const Options &opts) {
+  const std::vector<std::string> &filenames = opts.files;
 
-    ssize_t bytes_read;
-    // read until we hit EOF.
-    do {
-      auto ret = sys::read(fd, chunk_size, buffer.get());
+  std::vector<std::string> small_files;
+  std::vector<std::string> big_files;
+  size_t                   total_bytes = 0;
 
-      if (!ret) {
-        return Error{ret, "error reading file " + escape(name)};
-      } else {
-        bytes_read = ret.get_value();
-      }
+  if (filenames.empty()) {
+    total_bytes = file_size(0).value_or(0);
+  }
 
-      accum += bc::bitcount(bytes_read, buffer.get());
-    } while (bytes_read != 0);
+  for (const std::string &filename : filenames) {
+    const auto size = file_size(filename);
 
-    return accum;
+    total_bytes += size.value_or(0);
+    (size && *size >= SPLIT_SIZE ? big_files : small_files).push_back(filename);
   }
 
-  /// mmap file in one go and do popcount
-  Result<Count, Error> mmap_bitcount(int fd, const std::string &name, size_t size) const {
-    auto mmap = sys::mmap(fd, size);
-    if (!mmap) {
-      return Error{mmap, "could not mmap file " + escape(name)};
+  /// *** progress reporting, also prints what we have so far if we are interrupted
+
+  /// without reports there is no need for a reporter thread, nor for keeping track of progress
+  const bool reporting = opts.progress_interval > 0 || opts.partial;
+
+  FILE *progress_out = stderr;
+  if (!opts.progress_file.empty()) {
+    progress_out = fopen(opts.progress_file.c_str(), "a");
+
+    if (!progress_out) {
+      fprintf(stderr, "error: could not open progress file %s\n", escape(opts.progress_file).c_str());
+      return 1;
+    }
+  }
+  auto progress_closer = on_exit([&]() {
+    if (progress_out != stderr) {
+      fclose(progress_out);
     }
-    auto unmapper = on_exit([&]() { sys::munmap(*mmap, size); });
+  });
 
-    const uint8_t *data = (const uint8_t*) *mmap;
+  /// we only know how big compressed files are, not what they decompress to
+  std::optional<Progress> progress;
+  if (reporting) {
+    progress.emplace(opts.decompress ? 0 : total_bytes);
+  }
 
-    assert((uintptr_t(data) % 64 == 0) && "mmap returned unaligned data?");
+  const File_Bit_Counter files{tuning, numa, progress ? &*progress : nullptr};
 
-    Count accum = bc::bitcount(size, data);
-    return accum;
+  std::optional<Progress_Reporter> reporter;
+  if (reporting) {
+    std::function<void(Count)> on_interrupt;
+    if (opts.partial) {
+      on_interrupt = [](Count partial) {
+        if (partial.bits() > 0) {
+          print_count(partial, "<partial>");
+        }
+      };
+    }
+
+    reporter.emplace(*progress, progress_out, opts.progress_interval, std::move(on_interrupt));
   }
 
-  const size_t chunk_size;
-};
+  /// *** count
 
-int main(int argc, const char *const *argv) {
-  const auto page_size = sys::get_page_size();
-  if (!page_size) {
-    fprintf(stderr, "error getting page size: %s\n", page_size.get_error().message().c_str());
-    return 1;
+  if (opts.tar) {
+    return count_tar_files(files, filenames);
   }
 
-  const File_Bit_Counter files{4 * *page_size};
+  /// Stream buffers of every thread, reused from file to file. With numa each is on the node of its thread.
+  std::vector<Bitcount_Buffer> buffers;
+  if (numa) {
+    buffers = numa->allocate_buffers(files.get_chunk_size(), files.get_huge_pages());
+  } else {
+    for (int i = 0, e = omp::max_threads(); i < e; i++) {
+      buffers.push_back(files.allocate_buffer());
+    }
+  }
 
-  if (argc < 2) {
-    auto cnt = files.bitcount(0, "<stdin>");
+  if (filenames.empty()) {
+    auto cnt = opts.decompress ? files.bitcount_decompressed(0, "<stdin>", buffers[0]) : files.bitcount(0, "<stdin>", buffers[0]);
     if (!cnt) {
       fprintf(stderr, "error: %s\n", cnt.get_error().message().c_str());
     } else {
@@ -211,12 +367,27 @@ int main(int argc, const char *const *argv) {
   } else {
     Count total;
 
-    BC_OMP(parallel for shared(total) schedule(dynamic))
-    for (int i = 1; i < argc; i++) {
+    for (const std::string &filename : big_files) {
+      auto cnt = opts.decompress ? files.bitcount_decompressed(filename, buffers[0]) : files.bitcount(filename, buffers[0]);
+      if (!cnt) {
+        fprintf(stderr, "error: %s\n", cnt.get_error().message().c_str());
+      } else {
+        print_count(*cnt, filename);
+        total += *cnt;
+      }
+    }
+
+    /// big files above still get the whole team, the tuned thread count is for counting many files at once
+    const int num_threads = files.get_num_threads();
+
+    BC_OMP(parallel for num_threads(num_threads) shared(total) schedule(dynamic))
+    for (int i = 0; i < int(small_files.size()); i++) {
       {
-        const std::string filename = argv[i];
+        const std::string &filename = small_files[i];
+
+        Bitcount_Buffer &buffer = buffers[omp::thread_num()];
 
-        auto cnt = files.bitcount(filename);
+        auto cnt = opts.decompress ? files.bitcount_decompressed(filename, buffer) : files.bitcount(filename, buffer);
         if (!cnt) {
           fprintf(stderr, "error: %s\n", cnt.get_error().message().c_str());
         } else {
@@ -231,7 +402,7 @@ int main(int argc, const char *const *argv) {
       }
     }
 
-    if (argc > 2) {
+    if (filenames.size() > 1) {
       print_count(total, "<total>");
     }
   }
@@ -239,3 +410,151 @@ int main(int argc, const char *const *argv) {
   return 0;
 }
 
+static int run_client(const Options &opts) {
+  auto client = Bitcount_Client::connect(opts.socket_path);
+  if (!client) {
+    fprintf(stderr, "error: %s\n", client.get_error().message().c_str());
+    return 1;
+  }
+
+  std::vector<std::string>      names;
+  std::vector<Bitcount_Request> batch;
+  std::vector<int>              fds;
+  auto closer = on_exit([&]() {
+    for (int fd : fds) {
+      sys::close(fd);
+    }
+  });
+
+  if (opts.files.empty()) {
+    names.push_back("<stdin>");
+    batch.push_back(Bitcount_Request::for_fd(0, "<stdin>"));
+  }
+
+  for (const std::string &file : opts.files) {
+    if (!opts.pass_fds) {
+      names.push_back(file);
+      batch.push_back(Bitcount_Request::for_path(file));
+      continue;
+    }
+
+    auto fd = sys::open(file);
+    if (!fd) {
+      fprintf(stderr, "error: %s\n", Error{fd, "could not open file " + escape(file)}.message().c_str());
+      continue;
+    }
+
+    fds.push_back(*fd);
+    names.push_back(file);
+    batch.push_back(Bitcount_Request::for_fd(*fd, file));
+  }
+
+  auto results = client->bitcount(batch);
+  if (!results) {
+    fprintf(stderr, "error: %s\n", results.get_error().message().c_str());
+    return 1;
+  }
+
+  Count total;
+
+  for (size_t i = 0; i < results->size(); i++) {
+    const auto &cnt = (*results)[i];
+
+    if (!cnt) {
+      fprintf(stderr, "error: %s\n", cnt.get_error().message().c_str());
+    } else {
+      print_count(*cnt, names[i]);
+      total += *cnt;
+    }
+  }
+
+  if (opts.files.size() > 1) {
+    print_count(total, "<total>");
+  }
+
+  return 0;
+}
+
+static int run_autotune(const Options &opts, size_t page_size) {
+  auto tuning = autotune(opts.scratch_dir, opts.scratch_size, page_size, stderr);
+  if (!tuning) {
+    fprintf(stderr, "error: %s\n", tuning.get_error().message().c_str());
+    return 1;
+  }
+
+  const std::string path = default_tuning_path();
+
+  auto saved = save_tuning(path, *tuning);
+  if (!saved) {
+    fprintf(stderr, "error: %s\n", saved.get_error().message().c_str());
+    return 1;
+  }
+
+  printf("wrote %s\n", escape(path).c_str());
+  return 0;
+}
+
+int main(int argc, const char *const *argv) {
+  const auto opts = parse_args(argc, argv);
+  if (!opts) {
+    print_usage(stderr, argv[0]);
+    return 1;
+  }
+
+  if (opts->help) {
+    print_usage(stdout, argv[0]);
+    return 0;
+  }
+
+  if (opts->mode == Options::CLIENT) {
+    return run_client(*opts);
+  }
+
+  const auto page_size = sys::get_page_size();
+  if (!page_size) {
+    fprintf(stderr, "error getting page size: %s\n", page_size.get_error().message().c_str());
+    return 1;
+  }
+
+  if (opts->mode == Options::TUNE) {
+    return run_autotune(*opts, *page_size);
+  }
+
+  Tuning tuning = Tuning::defaults(*page_size);
+  {
+    auto loaded = load_tuning(default_tuning_path(), *page_size);
+
+    if (loaded) {
+      tuning = *loaded;
+    } else if (loaded.get_error().EC != std::errc::no_such_file_or_directory) {
+      fprintf(stderr, "warning: %s, using default settings\n", loaded.get_error().message().c_str());
+    }
+  }
+
+  if (opts->no_mmap) {
+    tuning.mmap_threshold = std::numeric_limits<size_t>::max();
+  }
+
+  tuning.huge_pages |= opts->huge_pages;
+  tuning.populate   |= opts->populate;
+
+  /// on machines with a single node --numa would only cost us
+  const Numa numa       = opts->numa ? Numa::detect() : Numa{};
+  const Numa *numa_ptr = numa.enabled() ? &numa : nullptr;
+
+  if (numa_ptr) {
+    numa.pin_threads();
+  }
+
+  if (opts->mode == Options::SERVE) {
+    const File_Bit_Counter files{tuning, numa_ptr};
+
+    auto ret = serve(opts->socket_path, files);
+    if (!ret) {
+      fprintf(stderr, "error: %s\n", ret.get_error().message().c_str());
+    }
+    return 1;
+  }
+
+  return count_files(tuning, numa_ptr, *opts);
+}
@@ -0,0 +1,177 @@
+
+#include "numa.hpp"
+#include "bc_openmp.hpp"
+#include "progress.hpp"
+#include "sys.hpp"
+#include <algorithm> // std::find, std::fill, std::min
+#include <atomic>    // std::atomic
+#include <cstdio>    // fprintf
+#include <cstring>   // memset
+#include <optional>  // std::optional
+
+using namespace bc;
+
+Numa bc::Numa::detect() {
+  Numa numa;
+  numa.nodes = sys::numa_nodes();
+  return numa;
+}
+
+void bc::Numa::pin_threads() const {
+  if (!enabled()) {
+    return;
+  }
+
+  BC_OMP(parallel)
+  {
+    const int node = nodes[node_of_thread(omp::thread_num())];
+
+    auto ret = sys::numa_run_on_node(node);
+    if (!ret) {
+      fprintf(stderr, "warning: could not pin thread to NUMA node %d: %s\n", node, ret.get_error().message().c_str());
+    }
+  }
+}
+
+std::vector<Bitcount_Buffer> bc::Numa::allocate_buffers(size_t size, bool huge_pages) const {
+  auto allocate = [&]() {
+    return huge_pages ? Bitcount_Buffer::allocate_huge(size) : Bitcount_Buffer::allocate(size);
+  };
+
+  std::vector<std::optional<Bitcount_Buffer>> tmp(omp::max_threads());
+
+  BC_OMP(parallel)
+  {
+    const int tid = omp::thread_num();
+
+    /// pages are placed on the node of the thread that touches them first
+    tmp[tid].emplace(allocate());
+    memset(tmp[tid]->get(), 0, size);
+  }
+
+  std::vector<Bitcount_Buffer> buffers;
+  for (auto &buf : tmp) {
+    /// some OpenMP runtimes give us fewer threads than max_threads()
+    buffers.push_back(buf ? std::move(*buf) : allocate());
+  }
+  return buffers;
+}
+
+/// keeps the compiler from throwing away the bytes we only read to fault pages in
+static volatile uint8_t sink;
+
+/// node (index into nodes) of the stripe block i is in, for blocks we don't know about
+static size_t stripe_of(size_t i, size_t num_nodes, size_t num_blocks) {
+  return i * num_nodes / num_blocks;
+}
+
+/// first block of the stripe of node, i.e. the smallest i with stripe_of(i) == node
+static size_t stripe_begin(size_t node, size_t num_nodes, size_t num_blocks) {
+  return (node * num_blocks + num_nodes - 1) / num_nodes;
+}
+
+std::vector<int> bc::Numa::block_nodes(size_t size, const uint8_t *data) const {
+  const size_t num_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  const size_t num_nodes  = nodes.size();
+
+  std::vector<int> where(num_blocks, -1);
+
+  if (num_nodes <= 1) {
+    return where;
+  }
+
+  /// The kernel only knows where pages are once they are mapped, and file mappings are mapped lazily
+  /// (unless populated). So fault in the first page of every block, every node its own stripe:
+  /// cached pages then show up wherever they live, uncached ones are read in by the node counting them.
+  std::vector<std::atomic<size_t>> cursors(num_nodes);
+  for (size_t node = 0; node < num_nodes; node++) {
+    cursors[node].store(stripe_begin(node, num_nodes, num_blocks), std::memory_order_relaxed);
+  }
+
+  uint8_t touched = 0;
+
+  BC_OMP(parallel reduction(^: touched))
+  {
+    const size_t home = node_of_thread(omp::thread_num());
+
+    for (size_t k = 0; k < num_nodes; k++) {
+      const size_t node = (home + k) % num_nodes;
+      const size_t end  = stripe_begin(node + 1, num_nodes, num_blocks);
+
+      size_t i;
+      while ((i = cursors[node].fetch_add(1, std::memory_order_relaxed)) < end) {
+        touched ^= data[i * BLOCK_SIZE];
+      }
+    }
+  }
+
+  sink = touched;
+
+  std::vector<const void*> pages(num_blocks);
+  for (size_t i = 0; i < num_blocks; i++) {
+    pages[i] = data + i * BLOCK_SIZE;
+  }
+
+  /// if this fails everything counts as not mapped, which is fine
+  auto ret = sys::numa_page_nodes(num_blocks, pages.data(), where.data());
+  if (!ret) {
+    std::fill(where.begin(), where.end(), -1);
+  }
+
+  return where;
+}
+
+Count bc::Numa::bitcount(size_t size, const uint8_t *data, Kernel kernel, Progress *progress) const {
+  const size_t num_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  const size_t num_nodes  = nodes.size();
+
+  /// *** find out where the blocks live
+
+  const std::vector<int> where = block_nodes(size, data);
+
+  std::vector<std::vector<size_t>> buckets(num_nodes);
+
+  for (size_t i = 0; i < num_blocks; i++) {
+    auto it = std::find(nodes.begin(), nodes.end(), where[i]);
+
+    const size_t node = (it != nodes.end()) ? size_t(it - nodes.begin()) : stripe_of(i, num_nodes, num_blocks);
+
+    buckets[node].push_back(i);
+  }
+
+  /// *** count, every thread starts on its own node and helps out the others once that is done
+
+  std::vector<std::atomic<size_t>> cursors(num_nodes);
+  for (auto &cursor : cursors) {
+    cursor.store(0, std::memory_order_relaxed);
+  }
+
+  size_t num_ones = 0;
+
+  BC_OMP(parallel reduction(+: num_ones))
+  {
+    const size_t home = node_of_thread(omp::thread_num());
+
+    for (size_t k = 0; k < num_nodes; k++) {
+      const size_t node = (home + k) % num_nodes;
+
+      size_t i;
+      while ((i = cursors[node].fetch_add(1, std::memory_order_relaxed)) < buckets[node].size()) {
+        const size_t bgn = buckets[node][i] * BLOCK_SIZE;
+        const size_t len = std::min(BLOCK_SIZE, size - bgn);
+
+        const Count cnt = bc::bitcount(len, data + bgn, kernel);
+        num_ones += cnt.ones;
+
+        if (progress) {
+          progress->add(cnt);
+        }
+      }
+    }
+  }
+
+  Count cnt;
+  cnt.ones   = num_ones;
+  cnt.zeroes = size * 8 - num_ones;
+  return cnt;
+}
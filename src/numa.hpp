@@ -0,0 +1,46 @@
+
+#pragma once
+
+#include "bitcnt.hpp" // bc::Count, bc::Kernel, bc::Bitcount_Buffer
+#include <vector>     // std::vector
+
+namespace bc {
+
+/// NUMA topology, plus what we need to keep threads and the memory they touch on the same node.
+/// Everything still works on machines with only one node (or builds without libnuma),
+/// it just doesn't buy anything there.
+struct Numa final {
+  /// Granularity at which we look up where pages live and hand out work.
+  /// Big enough that the lookup is cheap, small enough to balance the load.
+  static constexpr size_t BLOCK_SIZE = 2 * 1024 * 1024;
+
+  static Numa detect();
+
+  /// true if there is more than one node
+  bool enabled() const { return nodes.size() > 1; }
+
+  /// index (into nodes) of the node OpenMP thread tid runs on
+  size_t node_of_thread(int tid) const { return size_t(tid) % nodes.size(); }
+
+  /// pin every thread of the OpenMP team to its node, call outside of a parallel region
+  void pin_threads() const;
+
+  /// one stream buffer per OpenMP thread, allocated and first touched by that thread so it ends up on its node
+  std::vector<Bitcount_Buffer> allocate_buffers(size_t size, bool huge_pages) const;
+
+  /// Node id of every BLOCK_SIZE block of a mapped range, going by its first page, -1 if unknown.
+  /// Faults in the first page of every block (in stripes, by the threads of the node that would
+  /// count the stripe), so lazily mapped files are looked up where their pages really are.
+  /// All -1 on a single node, or if the kernel can't tell us.
+  std::vector<int> block_nodes(size_t size, const uint8_t *data) const;
+
+  /// Count a mapped range with the whole OpenMP team, every node counts the blocks block_nodes() puts on it.
+  /// Blocks we don't know about are split into contiguous stripes, one per node.
+  /// Every block is added to progress, if it is not null.
+  Count bitcount(size_t size, const uint8_t *data, Kernel kernel, Progress *progress = nullptr) const;
+
+  /// NUMA node ids
+  std::vector<int> nodes;
+};
+
+} // end namespace bc
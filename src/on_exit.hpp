@@ -0,0 +1,25 @@
+
+#pragma once
+
+#include <utility> // std::forward
+
+namespace bc {
+
+/// RAII helper, runs a piece of code on scope exit
+template<typename Fn>
+struct On_Exit final {
+  On_Exit(Fn &&fn) : fn{fn} {}
+
+  ~On_Exit() {
+    fn();
+  }
+private:
+  Fn fn;
+};
+
+template<typename Fn>
+auto on_exit(Fn &&fn) {
+  return On_Exit<Fn>(std::forward<Fn>(fn));
+}
+
+} // end namespace bc
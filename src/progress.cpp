@@ -0,0 +1,154 @@
+
+#include "progress.hpp"
+#include "bc_openmp.hpp"
+#include "sys.hpp"
+#include <cstdlib> // std::_Exit
+
+using namespace bc;
+
+/// How often the reporter thread wakes up to check for signals, stopping it doesn't wait for this
+static constexpr std::chrono::milliseconds POLL_INTERVAL{100};
+
+bc::Progress::Progress(size_t total_bytes)
+: _total_bytes{total_bytes},
+  _num_slots{size_t(omp::max_threads())},
+  _slots{new Slot[_num_slots]},
+  _start{std::chrono::steady_clock::now()} {}
+
+void bc::Progress::add(Count cnt) {
+  Slot &slot = _slots[size_t(omp::thread_num()) % _num_slots];
+
+  slot.ones.fetch_add(cnt.ones, std::memory_order_relaxed);
+  slot.zeroes.fetch_add(cnt.zeroes, std::memory_order_relaxed);
+}
+
+Count bc::Progress::snapshot() const {
+  Count cnt;
+
+  for (size_t i = 0; i < _num_slots; i++) {
+    cnt.ones   += _slots[i].ones.load(std::memory_order_relaxed);
+    cnt.zeroes += _slots[i].zeroes.load(std::memory_order_relaxed);
+  }
+
+  return cnt;
+}
+
+bc::Progress_Reporter::Progress_Reporter(const Progress &progress, FILE *out, double interval,
+                                         std::function<void(Count)> on_interrupt)
+: _progress{progress}, _out{out}, _interval{interval}, _on_interrupt{std::move(on_interrupt)} {
+  _last_time = progress.start_time();
+
+  for (auto sig : {sys::Signal::INTERRUPT, sys::Signal::USER1}) {
+    if (!_on_interrupt) {
+      continue;
+    }
+
+    auto ret = sys::catch_signal(sig);
+    if (!ret) {
+      fprintf(stderr, "warning: could not install signal handler: %s\n", ret.get_error().message().c_str());
+    }
+  }
+
+  _thread = std::thread{[this]() { run(); }};
+}
+
+bc::Progress_Reporter::~Progress_Reporter() {
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _stop = true;
+  }
+  _cond.notify_one();
+
+  _thread.join();
+}
+
+void bc::Progress_Reporter::run() {
+  auto next_report = std::chrono::steady_clock::now() + std::chrono::duration<double>(_interval);
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock{_mutex};
+      if (_cond.wait_for(lock, POLL_INTERVAL, [&]() { return _stop; })) {
+        return;
+      }
+    }
+
+    if (sys::take_signal(sys::Signal::INTERRUPT)) {
+      report();
+      fflush(_out);
+
+      _on_interrupt(_progress.snapshot());
+      fflush(stdout);
+
+      /// the workers are still running, don't wait for them or run any destructors
+      std::_Exit(130);
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+
+    if (sys::take_signal(sys::Signal::USER1) || (_interval > 0 && now >= next_report)) {
+      report();
+      next_report = now + std::chrono::duration<double>(_interval);
+    }
+  }
+}
+
+static void format_bytes(char *buf, size_t buf_size, double bytes) {
+  const char *unit = "B";
+
+  if (bytes >= 1e12) {
+    unit = "TB"; bytes /= 1e12;
+  } else if (bytes >= 1e9) {
+    unit = "GB"; bytes /= 1e9;
+  } else if (bytes >= 1e6) {
+    unit = "MB"; bytes /= 1e6;
+  } else if (bytes >= 1e3) {
+    unit = "kB"; bytes /= 1e3;
+  }
+
+  snprintf(buf, buf_size, "%.1f %s", bytes, unit);
+}
+
+void bc::Progress_Reporter::report() {
+  const Count  cnt   = _progress.snapshot();
+  const size_t bytes = cnt.bits() / 8;
+  const auto   now   = std::chrono::steady_clock::now();
+
+  const double elapsed = std::chrono::duration<double>(now - _progress.start_time()).count();
+  const double since   = std::chrono::duration<double>(now - _last_time).count();
+
+  const double avg_rate = elapsed > 0 ? bytes / elapsed : 0;
+  const double cur_rate = since > 0 ? (bytes - _last_bytes) / since : avg_rate;
+
+  _last_bytes = bytes;
+  _last_time  = now;
+
+  char done[32], total[32], cur[32], avg[32];
+  format_bytes(done, sizeof(done), bytes);
+  format_bytes(total, sizeof(total), _progress.total_bytes());
+  format_bytes(cur, sizeof(cur), cur_rate);
+  format_bytes(avg, sizeof(avg), avg_rate);
+
+  fprintf(_out, "progress: %s", done);
+
+  if (_progress.total_bytes() > 0) {
+    fprintf(_out, " of %s (%.1f%%)", total, 100.0 * bytes / _progress.total_bytes());
+  }
+
+  fprintf(_out, ", %s/s (avg %s/s)", cur, avg);
+
+  if (_progress.total_bytes() > bytes && avg_rate > 0) {
+    const long eta = long((_progress.total_bytes() - bytes) / avg_rate);
+
+    fprintf(_out, ", ETA %ld:%02ld:%02ld", eta / 3600, (eta / 60) % 60, eta % 60);
+  }
+
+  fprintf(_out, ", %zu ones, %zu zeroes", cnt.ones, cnt.zeroes);
+
+  if (cnt.bits() > 0) {
+    fprintf(_out, " (%.3f%% ones)", cnt.percent_ones() * 100);
+  }
+
+  fprintf(_out, "\n");
+  fflush(_out);
+}
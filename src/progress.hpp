@@ -0,0 +1,71 @@
+
+#pragma once
+
+#include "bitcnt.hpp"         // bc::Count
+#include <atomic>             // std::atomic
+#include <chrono>             // std::chrono::steady_clock
+#include <condition_variable> // std::condition_variable
+#include <cstdio>             // FILE
+#include <functional>         // std::function
+#include <memory>             // std::unique_ptr
+#include <mutex>              // std::mutex
+#include <thread>             // std::thread
+
+namespace bc {
+
+/// Counts of everything processed so far, for progress reports on long scans.
+/// Workers add to their own slot (one cache line each) once per chunk, so there is no contention.
+struct Progress final {
+  /// total_bytes is how much we expect to process, 0 if we don't know
+  explicit Progress(size_t total_bytes);
+
+  /// call once per chunk, from any thread
+  void add(Count cnt);
+
+  /// partial count, summed over all slots
+  Count snapshot() const;
+
+  size_t total_bytes() const { return _total_bytes; }
+
+  std::chrono::steady_clock::time_point start_time() const { return _start; }
+private:
+  struct alignas(64) Slot final {
+    std::atomic<size_t> ones{0};
+    std::atomic<size_t> zeroes{0};
+  };
+
+  const size_t                                _total_bytes;
+  const size_t                                _num_slots;
+  std::unique_ptr<Slot[]>                     _slots;
+  const std::chrono::steady_clock::time_point _start;
+};
+
+/// Prints a progress line (bytes, ones & zeroes so far, throughput) to out every interval seconds
+/// (never if interval is 0) and whenever we get SIGUSR1.
+/// On SIGINT calls on_interrupt with the partial count and exits.
+/// Without on_interrupt both signals are left alone, only the periodic reports are printed.
+/// Runs a thread of its own, which stops right away when the reporter is destroyed.
+struct Progress_Reporter final {
+  Progress_Reporter(const Progress &progress, FILE *out, double interval, std::function<void(Count)> on_interrupt);
+  Progress_Reporter(const Progress_Reporter&) = delete;
+  ~Progress_Reporter();
+private:
+  void run();
+
+  void report();
+
+  const Progress            &_progress;
+  FILE                      *_out;
+  const double               _interval;
+  std::function<void(Count)> _on_interrupt;
+  std::mutex                 _mutex;
+  std::condition_variable    _cond;
+  bool                       _stop = false;
+  std::thread                _thread;
+
+  /// for computing the current throughput
+  size_t                                _last_bytes = 0;
+  std::chrono::steady_clock::time_point _last_time;
+};
+
+} // end namespace bc
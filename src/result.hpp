@@ -4,6 +4,7 @@
 #include <cassert>     // assert
 #include <variant>     // std::variant
 #include <type_traits> // std::is_same_v
+#include <utility>     // std::move
 
 namespace bc {
 
@@ -18,8 +19,12 @@ struct Result final {
 
   Result(const T &val) : _data{std::in_place_type<value_type>, val} {}
 
+  Result(T &&val) : _data{std::in_place_type<value_type>, std::move(val)} {}
+
   Result(const Err &err) : _data{std::in_place_type<error_type>, err} {}
 
+  Result(Err &&err) : _data{std::in_place_type<error_type>, std::move(err)} {}
+
   /// observers
 
   bool has_value() const {
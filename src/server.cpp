@@ -0,0 +1,548 @@
+
+#include "server.hpp"
+#include "bc_openmp.hpp"
+#include "on_exit.hpp"
+#include "sys.hpp"
+#include <cassert> // assert
+#include <cstdio>  // fprintf
+#include <cstdlib> // strtoull, strtol
+#include <cstring> // memcpy, memset
+
+using namespace bc;
+
+/// The most file descriptors passed along with one message
+static constexpr size_t MAX_FDS_PER_MESSAGE = 253;
+
+/// Refuse absurdly large messages instead of trying to allocate memory for them
+static constexpr size_t MAX_MESSAGE_SIZE = 16 * 1024 * 1024;
+
+struct Message_Header final {
+  uint32_t size;
+  uint32_t num_fds;
+};
+
+/// read exactly size bytes, returns false if the peer hung up before sending anything
+static Result<bool, std::error_code>
+recv_exact(int sock, size_t size, uint8_t *data, std::vector<int> &fds) {
+  size_t done = 0;
+
+  while (done < size) {
+    auto ret = sys::recv(sock, size - done, data + done, fds);
+    if (!ret) {
+      return ret.get_error();
+    }
+
+    if (*ret == 0) {
+      if (done == 0) {
+        return false;
+      }
+      return std::make_error_code(std::errc::connection_aborted);
+    }
+
+    done += *ret;
+  }
+
+  return true;
+}
+
+/// returns false if the peer hung up cleanly
+static Result<bool, std::error_code>
+recv_message(int sock, std::string &body, std::vector<int> &fds) {
+  Message_Header header;
+
+  auto got_header = recv_exact(sock, sizeof(header), (uint8_t*) &header, fds);
+  if (!got_header || !*got_header) {
+    return got_header;
+  }
+
+  if (header.size > MAX_MESSAGE_SIZE || header.num_fds != fds.size()) {
+    return std::make_error_code(std::errc::bad_message);
+  }
+
+  body.resize(header.size);
+
+  auto got_body = recv_exact(sock, body.size(), (uint8_t*) body.data(), fds);
+  if (!got_body) {
+    return got_body;
+  }
+  if (!*got_body && !body.empty()) {
+    return std::make_error_code(std::errc::connection_aborted);
+  }
+
+  return true;
+}
+
+/// header followed by body, ready to be sent
+static std::string frame_message(const std::string &body, size_t num_fds) {
+  assert(body.size() <= MAX_MESSAGE_SIZE);
+  assert(num_fds <= MAX_FDS_PER_MESSAGE);
+
+  std::string msg(sizeof(Message_Header), '\0');
+  {
+    Message_Header header;
+    header.size    = uint32_t(body.size());
+    header.num_fds = uint32_t(num_fds);
+    memcpy(msg.data(), &header, sizeof(header));
+  }
+  msg += body;
+
+  return msg;
+}
+
+static Result<std::nullopt_t, std::error_code>
+send_message(int sock, const std::string &body, const std::vector<int> &fds) {
+  const std::string msg = frame_message(body, fds.size());
+
+  return sys::send(sock, msg.size(), (const uint8_t*) msg.data(), fds);
+}
+
+/// ***** server
+
+namespace {
+
+/// One record from a request, plus the slot its result goes into
+struct Pending final {
+  /// index of the request message it came from, every message gets one response
+  size_t      message;
+  std::string name;
+  int         fd;
+  std::string error; /// non-empty if the record was malformed
+};
+
+/// A connected client. Sockets are non-blocking, so a client that sends half a message
+/// or doesn't read its responses only holds up itself.
+struct Client final {
+  int              sock;
+  /// received bytes that don't make a complete message yet
+  std::string      in;
+  /// received file descriptors that no complete message has claimed yet
+  std::vector<int> in_fds;
+  /// responses not sent yet
+  std::string      out;
+  size_t           out_pos = 0;
+  /// peer is done sending, drop it once everything is sent
+  bool             eof     = false;
+  bool             failed  = false;
+};
+
+} // end anonymous namespace
+
+static void parse_request(size_t message, const std::string &body, const std::vector<int> &fds, std::vector<Pending> &out) {
+  size_t next_fd = 0;
+  size_t pos     = 0;
+
+  while (pos < body.size()) {
+    size_t end = body.find('\0', pos);
+    if (end == std::string::npos) {
+      end = body.size();
+    }
+
+    const std::string record = body.substr(pos, end - pos);
+    pos = end + 1;
+
+    Pending p{message, "", -1, ""};
+
+    if (record.size() < 2) {
+      p.error = "malformed request record";
+    } else if (record[0] == 'P') {
+      p.name = record.substr(1);
+    } else if (record[0] == 'F') {
+      p.name = record.substr(1);
+
+      if (next_fd < fds.size()) {
+        p.fd = fds[next_fd++];
+      } else {
+        p.error = "no file descriptor passed for " + escape(p.name);
+      }
+    } else {
+      p.error = "malformed request record";
+    }
+
+    out.push_back(p);
+  }
+
+  /// close fds nobody asked us to count
+  for (; next_fd < fds.size(); next_fd++) {
+    sys::close(fds[next_fd]);
+  }
+}
+
+static void append_response(std::string &out, const Result<Count, Error> &res) {
+  if (res) {
+    out += std::to_string(res->ones);
+    out += ' ';
+    out += std::to_string(res->zeroes);
+  } else {
+    out += '!';
+    out += std::to_string(res.get_error().EC.value());
+    out += ' ';
+    out += res.get_error().msg;
+  }
+  out += '\n';
+}
+
+/// Take the next complete message out of what a client sent so far.
+/// Returns false if there is none yet, fails if the client sent garbage.
+static Result<bool, std::error_code> take_message(Client &client, std::string &body, std::vector<int> &fds) {
+  Message_Header header;
+  if (client.in.size() < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, client.in.data(), sizeof(header));
+
+  if (header.size > MAX_MESSAGE_SIZE || header.num_fds > MAX_FDS_PER_MESSAGE) {
+    return std::make_error_code(std::errc::bad_message);
+  }
+
+  if (client.in.size() < sizeof(header) + header.size) {
+    return false;
+  }
+
+  /// file descriptors arrive with the first byte of their message, so by now they are all here
+  if (client.in_fds.size() < header.num_fds) {
+    return std::make_error_code(std::errc::bad_message);
+  }
+
+  body.assign(client.in, sizeof(header), header.size);
+  client.in.erase(0, sizeof(header) + header.size);
+
+  fds.assign(client.in_fds.begin(), client.in_fds.begin() + header.num_fds);
+  client.in_fds.erase(client.in_fds.begin(), client.in_fds.begin() + header.num_fds);
+
+  return true;
+}
+
+static bool would_block(const std::error_code &err) {
+  return err == std::errc::resource_unavailable_try_again || err == std::errc::operation_would_block;
+}
+
+/// read whatever is there without blocking
+static void receive(Client &client) {
+  uint8_t buffer[64 * 1024];
+
+  auto got = sys::recv(client.sock, sizeof(buffer), buffer, client.in_fds);
+  if (!got) {
+    if (!would_block(got.get_error())) {
+      fprintf(stderr, "warning: dropping client: %s\n", got.get_error().message().c_str());
+      client.failed = true;
+    }
+    return;
+  }
+
+  if (*got == 0) {
+    client.eof = true;
+    return;
+  }
+
+  client.in.append((const char*) buffer, *got);
+}
+
+/// send as much of the pending responses as the client takes without blocking
+static void flush(Client &client) {
+  while (client.out_pos < client.out.size()) {
+    auto sent = sys::send_some(client.sock, client.out.size() - client.out_pos, (const uint8_t*) client.out.data() + client.out_pos);
+    if (!sent) {
+      if (!would_block(sent.get_error())) {
+        fprintf(stderr, "warning: dropping client: %s\n", sent.get_error().message().c_str());
+        client.failed = true;
+      }
+      return;
+    }
+
+    client.out_pos += *sent;
+  }
+
+  client.out.clear();
+  client.out_pos = 0;
+}
+
+static void drop(Client &client) {
+  sys::close(client.sock);
+
+  for (int fd : client.in_fds) {
+    sys::close(fd);
+  }
+}
+
+/// Only regular files and block devices are counted, anything else could keep us waiting for
+/// a writer or for EOF (FIFOs, pipes, sockets, ...) and with us every other client.
+static Result<Count, Error> count_pending(const Pending &p, const File_Bit_Counter &files, Bitcount_Buffer &buffer) {
+  if (!p.error.empty()) {
+    return Error{std::make_error_code(std::errc::invalid_argument), p.error};
+  }
+
+  int fd = p.fd;
+  if (fd < 0) {
+    auto opened = sys::open(p.name, true);
+    if (!opened) {
+      return Error{opened, "could not open file " + escape(p.name)};
+    }
+    fd = *opened;
+  }
+  auto closer = on_exit([&]() { sys::close(fd); });
+
+  auto stat = sys::stat(fd);
+  if (!stat) {
+    return Error{stat, "could not stat file " + escape(p.name)};
+  }
+  if (stat->type != sys::Stat::REGULAR && stat->type != sys::Stat::BLOCK) {
+    return Error{std::make_error_code(std::errc::invalid_argument), escape(p.name) + ": not a regular file or block device"};
+  }
+
+  return files.bitcount(fd, p.name, buffer);
+}
+
+Result<std::nullopt_t, Error> bc::serve(const std::string &socket_path, const File_Bit_Counter &files) {
+  /// One stream buffer per worker, allocated and touched up front so the first request
+  /// doesn't pay for page faults.
+  std::vector<Bitcount_Buffer> buffers;
+  for (int i = 0, e = omp::max_threads(); i < e; i++) {
+    buffers.push_back(files.allocate_buffer());
+    memset(buffers.back().get(), 0, files.get_chunk_size());
+  }
+
+  /// spin up the OpenMP thread team before the first request arrives
+  BC_OMP(parallel)
+  {
+    (void) omp::thread_num();
+  }
+
+  auto listener = sys::listen_unix(socket_path);
+  if (!listener) {
+    return Error{listener, "could not listen on " + escape(socket_path)};
+  }
+
+  const uint32_t uid = sys::get_uid();
+
+  std::vector<Client> clients;
+
+  while (true) {
+    /// clients with responses waiting don't get to send more requests until they read them
+    std::vector<sys::Poll_Fd> poll_fds(clients.size() + 1);
+
+    poll_fds[0].fd        = *listener;
+    poll_fds[0].want_read = true;
+
+    for (size_t i = 0; i < clients.size(); i++) {
+      poll_fds[i + 1].fd         = clients[i].sock;
+      poll_fds[i + 1].want_read  = clients[i].out.empty() && !clients[i].eof;
+      poll_fds[i + 1].want_write = !clients[i].out.empty();
+    }
+
+    auto ready = sys::wait_ready(poll_fds);
+    if (!ready) {
+      return Error{ready, "error waiting for requests"};
+    }
+
+    /// *** read & write whatever is ready, collect complete requests
+
+    std::vector<Pending> batch;
+    /// client of every request message in this batch
+    std::vector<size_t>  messages;
+
+    for (size_t client = 0; client < clients.size(); client++) {
+      Client &c = clients[client];
+
+      if (poll_fds[client + 1].writable) {
+        flush(c);
+      }
+      if (poll_fds[client + 1].readable) {
+        receive(c);
+      }
+
+      while (!c.failed) {
+        std::string      body;
+        std::vector<int> fds;
+
+        auto got = take_message(c, body, fds);
+        if (!got) {
+          fprintf(stderr, "warning: dropping client: %s\n", got.get_error().message().c_str());
+          c.failed = true;
+        }
+        if (!got || !*got) {
+          break;
+        }
+
+        parse_request(messages.size(), body, fds, batch);
+        messages.push_back(client);
+      }
+    }
+
+    /// *** count everything that came in, across all clients, in one go
+
+    std::vector<Result<Count, Error>> results(batch.size(), Count{});
+
+    const int num_threads = files.get_num_threads();
+
+    BC_OMP(parallel for num_threads(num_threads) schedule(dynamic))
+    for (long i = 0; i < long(batch.size()); i++) {
+      results[i] = count_pending(batch[i], files, buffers[omp::thread_num()]);
+    }
+
+    std::vector<std::string> responses(messages.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+      append_response(responses[batch[i].message], results[i]);
+    }
+
+    for (size_t message = 0; message < messages.size(); message++) {
+      Client &c = clients[messages[message]];
+      c.out += frame_message(responses[message], 0);
+    }
+
+    for (Client &c : clients) {
+      if (!c.out.empty() && !c.failed) {
+        flush(c);
+      }
+    }
+
+    /// *** forget about clients that went away
+
+    {
+      std::vector<Client> alive;
+      for (Client &c : clients) {
+        if (c.failed || (c.eof && c.out.empty())) {
+          drop(c);
+        } else {
+          alive.push_back(std::move(c));
+        }
+      }
+      clients.swap(alive);
+    }
+
+    if (poll_fds[0].readable) {
+      auto client = sys::accept(*listener);
+      if (!client) {
+        fprintf(stderr, "warning: could not accept connection: %s\n", client.get_error().message().c_str());
+        continue;
+      }
+
+      /// the socket is private already, this is for systems that ignore permissions on sockets
+      auto peer = sys::peer_uid(*client);
+      if (!peer || *peer != uid) {
+        fprintf(stderr, "warning: refusing connection from another user\n");
+        sys::close(*client);
+        continue;
+      }
+
+      auto nonblocking = sys::set_nonblocking(*client);
+      if (!nonblocking) {
+        fprintf(stderr, "warning: could not accept connection: %s\n", nonblocking.get_error().message().c_str());
+        sys::close(*client);
+        continue;
+      }
+
+      clients.push_back(Client{*client, {}, {}, {}, 0, false, false});
+    }
+  }
+}
+
+/// ***** client
+
+Result<Bitcount_Client, Error> bc::Bitcount_Client::connect(const std::string &socket_path) {
+  auto sock = sys::connect_unix(socket_path);
+  if (!sock) {
+    return Error{sock, "could not connect to " + escape(socket_path)};
+  }
+
+  return Bitcount_Client{*sock};
+}
+
+bc::Bitcount_Client::~Bitcount_Client() {
+  if (_sock != -1) {
+    sys::close(_sock);
+    _sock = -1;
+  }
+}
+
+static Result<Count, Error> parse_response_line(const std::string &line) {
+  if (!line.empty() && line[0] == '!') {
+    char *end = nullptr;
+    const long err = strtol(line.c_str() + 1, &end, 10);
+
+    std::string msg = end;
+    if (!msg.empty() && msg[0] == ' ') {
+      msg.erase(0, 1);
+    }
+
+    return Error{std::error_code(int(err), std::generic_category()), msg};
+  }
+
+  char *end = nullptr;
+
+  Count cnt;
+  cnt.ones   = strtoull(line.c_str(), &end, 10);
+  cnt.zeroes = strtoull(end, &end, 10);
+  return cnt;
+}
+
+Result<std::vector<Result<Count, Error>>, Error>
+bc::Bitcount_Client::bitcount(const std::vector<Bitcount_Request> &batch) {
+  std::vector<Result<Count, Error>> out;
+
+  size_t pos = 0;
+  while (pos < batch.size()) {
+    std::string      body;
+    std::vector<int> fds;
+
+    /// pack as many records into this message as fit
+    const size_t first = pos;
+    for (; pos < batch.size(); pos++) {
+      const Bitcount_Request &req = batch[pos];
+
+      if (req.fd >= 0 && fds.size() == MAX_FDS_PER_MESSAGE) {
+        break;
+      }
+      if (pos != first && body.size() + req.name.size() + 2 > MAX_MESSAGE_SIZE) {
+        break;
+      }
+
+      body += (req.fd >= 0) ? 'F' : 'P';
+      body += req.name;
+      body += '\0';
+
+      if (req.fd >= 0) {
+        fds.push_back(req.fd);
+      }
+    }
+
+    if (body.size() > MAX_MESSAGE_SIZE) {
+      return Error{std::make_error_code(std::errc::filename_too_long), "request too large"};
+    }
+
+    auto sent = send_message(_sock, body, fds);
+    if (!sent) {
+      return Error{sent, "could not send request"};
+    }
+
+    std::string      response;
+    std::vector<int> no_fds;
+
+    auto got = recv_message(_sock, response, no_fds);
+    if (!got) {
+      return Error{got, "could not receive response"};
+    }
+    if (!*got) {
+      return Error{std::make_error_code(std::errc::connection_reset), "server hung up"};
+    }
+    for (int fd : no_fds) {
+      sys::close(fd);
+    }
+
+    size_t line_bgn = 0;
+    while (line_bgn < response.size()) {
+      size_t line_end = response.find('\n', line_bgn);
+      if (line_end == std::string::npos) {
+        line_end = response.size();
+      }
+
+      out.push_back(parse_response_line(response.substr(line_bgn, line_end - line_bgn)));
+      line_bgn = line_end + 1;
+    }
+
+    if (out.size() != pos) {
+      return Error{std::make_error_code(std::errc::bad_message), "malformed response from server"};
+    }
+  }
+
+  return out;
+}
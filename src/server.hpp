@@ -0,0 +1,66 @@
+
+#pragma once
+
+#include "bitcnt.hpp"           // bc::Count
+#include "error.hpp"            // bc::Error
+#include "file_bit_counter.hpp" // bc::File_Bit_Counter
+#include "result.hpp"           // bc::Result
+#include <optional>             // std::nullopt_t
+#include <string>               // std::string
+#include <vector>               // std::vector
+
+/// A long running bitcount server listening on a unix domain socket.
+/// It keeps its OpenMP threads and stream buffers warm between requests, so clients that
+/// count lots of small files don't pay for process startup over and over again.
+///
+/// Wire format, every message is:
+///   uint32_t size, uint32_t num_fds  (host byte order, file descriptors are passed along with these bytes)
+///   <size> bytes of body
+/// Request body:  a sequence of NUL terminated records,
+///                'P' <path>, the server opens the path itself, or
+///                'F' <name>, count the next passed file descriptor, name is only used in error messages.
+/// Response body: one line per record, in order,
+///                "<ones> <zeroes>\n" or "!<errno> <error message>\n"
+
+namespace bc {
+
+/// One file to count
+struct Bitcount_Request final {
+  static Bitcount_Request for_path(const std::string &path) {
+    return Bitcount_Request{path, -1};
+  }
+
+  /// The fd stays owned by the caller
+  static Bitcount_Request for_fd(int fd, const std::string &name) {
+    return Bitcount_Request{name, fd};
+  }
+
+  std::string name;
+  int         fd;
+};
+
+/// Serve requests on socket_path until something goes horribly wrong.
+/// All records that arrive at the same time (from one or more clients) are counted as one parallel batch.
+/// Only the user running the server may connect, 'P' records open files with its permissions.
+/// Only regular files and block devices are counted, FIFOs, pipes & co get an error.
+/// Clients are never waited for, ones that stall or send garbage are dropped without holding up the others.
+Result<std::nullopt_t, Error> serve(const std::string &socket_path, const File_Bit_Counter &files);
+
+/// One connection to a running server
+struct Bitcount_Client final {
+  static Result<Bitcount_Client, Error> connect(const std::string &socket_path);
+
+  Bitcount_Client(Bitcount_Client &&that) : _sock{that._sock} { that._sock = -1; }
+  Bitcount_Client(const Bitcount_Client&) = delete;
+  ~Bitcount_Client();
+
+  /// Count a batch of files, returns one result per request, in order.
+  /// Large batches are transparently split into several messages.
+  Result<std::vector<Result<Count, Error>>, Error> bitcount(const std::vector<Bitcount_Request> &batch);
+private:
+  explicit Bitcount_Client(int sock) : _sock{sock} {}
+
+  int _sock;
+};
+
+} // end namespace bc
@@ -1,9 +1,36 @@
 
 #include "sys.hpp"
+#include "config.h"
 #include <unistd.h>
-#include <fcntl.h>     // for O_RDONLY, O_CLOEXEC
+#include <fcntl.h>     // for O_RDONLY, O_CLOEXEC, O_NONBLOCK
 #include <sys/stat.h>  // for fstat
 #include <sys/mman.h>  // for mmap, MAP_PRIVATE, MAP_FAILED, ...
+#include <sys/ioctl.h> // for ioctl
+#include <sys/socket.h> // for socket, sendmsg, recvmsg, SCM_RIGHTS, ...
+#include <sys/un.h>    // for sockaddr_un
+#include <poll.h>      // for poll
+#include <sched.h>     // for sched_yield
+#include <csignal>     // for sigaction, sig_atomic_t
+#include <cstring>     // for memcpy, strlen
+#include <cstdlib>     // for mkstemp
+#include <algorithm>   // for std::max, std::min
+
+#if defined(__linux__)
+#  include <linux/fs.h> // for BLKGETSIZE64
+#elif defined(__APPLE__)
+#  include <sys/disk.h> // for DKIOCGETBLOCKCOUNT, DKIOCGETBLOCKSIZE
+#endif
+
+#if BC_HAVE_LIBNUMA
+#  include <numa.h>    // for numa_available, numa_run_on_node, numa_move_pages, ...
+#endif
+
+#if BC_HAVE_IO_URING
+#  include <linux/io_uring.h> // for io_uring_params, io_uring_sqe, io_uring_cqe, IORING_*
+#  include <sys/eventfd.h>    // for eventfd
+#  include <sys/syscall.h>    // for __NR_io_uring_setup, __NR_io_uring_enter
+#  include <mutex>            // for std::mutex, std::lock_guard
+#endif
 
 using namespace bc;
 using namespace bc::sys;
@@ -22,11 +49,13 @@ static inline std::error_code error_from_errno() {
   return std::error_code(errno, std::generic_category());
 }
 
-Result<int,std::error_code> bc::sys::open(const std::string &file) {
+Result<int,std::error_code> bc::sys::open(const std::string &file, bool nonblocking) {
   int open_flags = O_RDONLY;
 #ifdef O_CLOEXEC
   open_flags |= O_CLOEXEC;
 #endif
+  if (nonblocking)
+    open_flags |= O_NONBLOCK;
 
   int fd;
   if ((fd = retry_after_signal(-1, ::open, file.c_str(), open_flags)) < 0)
@@ -88,12 +117,44 @@ Result<ssize_t,std::error_code> bc::sys::read(int fd, size_t count, uint8_t *buf
   return bytes_read;
 }
 
-Result<void*,std::error_code> bc::sys::mmap(int fd, size_t length) {
+Result<ssize_t,std::error_code> bc::sys::pread(int fd, size_t count, size_t offset, uint8_t *buffer) {
+  ssize_t bytes_read = retry_after_signal(-1, ::pread, fd, (void*) buffer, count, off_t(offset));
+
+  if (bytes_read == -1)
+    return error_from_errno();
+
+  return bytes_read;
+}
+
+Result<size_t,std::error_code> bc::sys::tell(int fd) {
+  const off_t pos = ::lseek(fd, 0, SEEK_CUR);
+
+  if (pos == -1)
+    return error_from_errno();
+
+  return size_t(pos);
+}
+
+Result<std::nullopt_t,std::error_code> bc::sys::seek(int fd, size_t offset) {
+  if (::lseek(fd, off_t(offset), SEEK_SET) == -1)
+    return error_from_errno();
+
+  return std::nullopt;
+}
+
+Result<void*,std::error_code> bc::sys::mmap(int fd, size_t length, unsigned bc_flags) {
   assert(length != 0);
 
   int flags = MAP_PRIVATE;
   int prot  = PROT_READ;
 
+  /// MAP_POPULATE would fault the mapping in with small pages before it can be advised to use huge ones
+#if defined(MAP_POPULATE)
+  const int populate = (bc_flags & MMAP_POPULATE) && !(bc_flags & MMAP_HUGE) ? MAP_POPULATE : 0;
+#else
+  const int populate = 0;
+#endif
+
 #if defined(__APPLE__)
   //----------------------------------------------------------------------
   // Newer versions of MacOSX have a flag that will allow us to read from
@@ -112,11 +173,66 @@ Result<void*,std::error_code> bc::sys::mmap(int fd, size_t length) {
 #endif
 #endif // #if defined (__APPLE__)
 
-  void *const mapping = ::mmap(nullptr, length, prot, flags, fd, 0);
+  void *mapping = ::mmap(nullptr, length, prot, flags | populate, fd, 0);
+
+  /// some systems refuse MAP_POPULATE for some files, just map without
+  if (mapping == MAP_FAILED && populate)
+    mapping = ::mmap(nullptr, length, prot, flags, fd, 0);
+
+  if (mapping == MAP_FAILED)
+    return error_from_errno();
+
+  if (bc_flags & MMAP_HUGE) {
+    /// only some file systems can back file mappings with huge pages, not a problem if this fails
+    advise_huge(mapping, length);
+
+    if (bc_flags & MMAP_POPULATE)
+      populate_read(mapping, length);
+  }
+
+  return mapping;
+}
+
+void bc::sys::populate_read(const void *mapping, size_t length) {
+#if defined(MADV_POPULATE_READ)
+  if (::madvise(const_cast<void*>(mapping), length, MADV_POPULATE_READ) == 0)
+    return;
+#endif
+
+  /// older kernels don't know MADV_POPULATE_READ, fault the pages in by hand
+  const size_t page_size = size_t(::sysconf(_SC_PAGESIZE));
+  const volatile uint8_t *bytes = static_cast<const volatile uint8_t*>(mapping);
+  for (size_t i = 0; i < length; i += page_size)
+    (void) bytes[i];
+}
+
+Result<void*,std::error_code> bc::sys::mmap_huge(size_t length) {
+  assert(length != 0 && length % HUGE_PAGE_SIZE == 0);
+
+#if defined(MAP_HUGETLB) && defined(MAP_ANONYMOUS)
+  void *const mapping = ::mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
   if (mapping == MAP_FAILED)
     return error_from_errno();
 
   return mapping;
+#else
+  (void) length;
+  return std::make_error_code(std::errc::function_not_supported);
+#endif
+}
+
+Result<std::nullopt_t,std::error_code> bc::sys::advise_huge(void *addr, size_t length) {
+#if defined(MADV_HUGEPAGE)
+  if (::madvise(addr, length, MADV_HUGEPAGE) == -1)
+    return error_from_errno();
+
+  return std::nullopt;
+#else
+  (void) addr;
+  (void) length;
+  return std::make_error_code(std::errc::function_not_supported);
+#endif
 }
 
 Result<std::nullopt_t,std::error_code> bc::sys::munmap(void *mapping, size_t length) {
@@ -157,6 +273,22 @@ Result<Stat,std::error_code> bc::sys::stat(int fd) {
 
   out.size = status.st_size;
 
+  /// fstat reports a size of 0 for block devices, ask the device itself
+  if (out.type == Stat::BLOCK) {
+#if defined(BLKGETSIZE64)
+    uint64_t bytes = 0;
+    if (::ioctl(fd, BLKGETSIZE64, &bytes) == 0) {
+      out.size = bytes;
+    }
+#elif defined(DKIOCGETBLOCKCOUNT) && defined(DKIOCGETBLOCKSIZE)
+    uint64_t count = 0;
+    uint32_t bsize = 0;
+    if (::ioctl(fd, DKIOCGETBLOCKCOUNT, &count) == 0 && ::ioctl(fd, DKIOCGETBLOCKSIZE, &bsize) == 0) {
+      out.size = count * bsize;
+    }
+#endif
+  }
+
   return out;
 }
 
@@ -169,3 +301,723 @@ Result<size_t,std::error_code> bc::sys::get_page_size() {
 
   return size_t(sz);
 }
+
+Result<int,std::error_code> bc::sys::create_temp_file(const std::string &dir, std::string &path) {
+  std::string templ = dir + "/bitcounter-XXXXXX";
+
+  int fd = ::mkstemp(&templ[0]);
+  if (fd == -1) {
+    return error_from_errno();
+  }
+
+  {
+    int r = fcntl(fd, F_SETFD, FD_CLOEXEC);
+    (void)r;
+    assert(r == 0 && "fcntl(F_SETFD, FD_CLOEXEC) failed");
+  }
+
+  path = templ;
+  return fd;
+}
+
+Result<std::nullopt_t,std::error_code> bc::sys::write(int fd, size_t count, const uint8_t *buffer) {
+  while (count > 0) {
+    ssize_t written = retry_after_signal(-1, ::write, fd, (const void*) buffer, count);
+
+    if (written == -1)
+      return error_from_errno();
+
+    buffer += written;
+    count  -= written;
+  }
+
+  return std::nullopt;
+}
+
+Result<std::nullopt_t,std::error_code> bc::sys::drop_cache(int fd) {
+  if (::fsync(fd) == -1) {
+    return error_from_errno();
+  }
+
+#if defined(POSIX_FADV_DONTNEED)
+  /// posix_fadvise returns the error instead of setting errno
+  if (int err = ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED)) {
+    return std::error_code(err, std::generic_category());
+  }
+#elif defined(F_NOCACHE)
+  /// MacOS has no posix_fadvise, the closest thing is to stop caching for this fd
+  if (::fcntl(fd, F_NOCACHE, 1) == -1) {
+    return error_from_errno();
+  }
+#endif
+
+  return std::nullopt;
+}
+
+Result<std::nullopt_t,std::error_code> bc::sys::unlink(const std::string &path) {
+  if (::unlink(path.c_str()) == -1) {
+    return error_from_errno();
+  }
+
+  return std::nullopt;
+}
+
+static volatile sig_atomic_t got_sigint  = 0;
+static volatile sig_atomic_t got_sigusr1 = 0;
+
+static void remember_signal(int signo) {
+  if (signo == SIGINT) {
+    got_sigint = 1;
+  } else if (signo == SIGUSR1) {
+    got_sigusr1 = 1;
+  }
+}
+
+Result<std::nullopt_t,std::error_code> bc::sys::catch_signal(Signal sig) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = remember_signal;
+  action.sa_flags   = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+
+  const int signo = (sig == Signal::INTERRUPT) ? SIGINT : SIGUSR1;
+
+  if (::sigaction(signo, &action, nullptr) == -1) {
+    return error_from_errno();
+  }
+
+  return std::nullopt;
+}
+
+bool bc::sys::take_signal(Signal sig) {
+  volatile sig_atomic_t &flag = (sig == Signal::INTERRUPT) ? got_sigint : got_sigusr1;
+
+  if (flag) {
+    flag = 0;
+    return true;
+  }
+
+  return false;
+}
+
+std::vector<int> bc::sys::numa_nodes() {
+#if BC_HAVE_LIBNUMA
+  if (numa_available() >= 0) {
+    std::vector<int> nodes;
+
+    for (int node = 0, max = numa_max_node(); node <= max; node++) {
+      if (numa_bitmask_isbitset(numa_all_nodes_ptr, node)) {
+        nodes.push_back(node);
+      }
+    }
+
+    if (!nodes.empty()) {
+      return nodes;
+    }
+  }
+#endif
+
+  return {0};
+}
+
+Result<std::nullopt_t,std::error_code> bc::sys::numa_run_on_node(int node) {
+#if BC_HAVE_LIBNUMA
+  if (numa_available() >= 0) {
+    if (::numa_run_on_node(node) == -1) {
+      return error_from_errno();
+    }
+    return std::nullopt;
+  }
+#endif
+
+  (void) node;
+  return std::make_error_code(std::errc::function_not_supported);
+}
+
+Result<std::nullopt_t,std::error_code> bc::sys::numa_page_nodes(size_t count, const void **pages, int *nodes) {
+#if BC_HAVE_LIBNUMA
+  if (numa_available() >= 0) {
+    /// with nodes == NULL move_pages doesn't move anything, it just tells us where pages are
+    if (numa_move_pages(0, count, (void**) pages, nullptr, nodes, 0) == -1) {
+      return error_from_errno();
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      if (nodes[i] < 0) {
+        nodes[i] = -1;
+      }
+    }
+    return std::nullopt;
+  }
+#endif
+
+  (void) pages;
+  for (size_t i = 0; i < count; i++) {
+    nodes[i] = -1;
+  }
+  return std::make_error_code(std::errc::function_not_supported);
+}
+
+/// The most file descriptors we pass along with a single send(), Linux' SCM_MAX_FD.
+static constexpr size_t MAX_FDS_PER_MSG = 253;
+
+static Result<int,std::error_code> unix_socket() {
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    return error_from_errno();
+  }
+
+  {
+    int r = fcntl(fd, F_SETFD, FD_CLOEXEC);
+    (void)r;
+    assert(r == 0 && "fcntl(F_SETFD, FD_CLOEXEC) failed");
+  }
+
+#if defined(SO_NOSIGPIPE)
+  /// no MSG_NOSIGNAL on MacOS, so turn off SIGPIPE for the whole socket
+  {
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+  }
+#endif
+
+  return fd;
+}
+
+static Result<sockaddr_un,std::error_code> unix_address(const std::string &path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return std::make_error_code(std::errc::filename_too_long);
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+  return addr;
+}
+
+Result<int,std::error_code> bc::sys::connect_unix(const std::string &path) {
+  auto addr = unix_address(path);
+  if (!addr) {
+    return addr.get_error();
+  }
+
+  auto sock = unix_socket();
+  if (!sock) {
+    return sock;
+  }
+
+  if (retry_after_signal(-1, ::connect, *sock, (const sockaddr*) &*addr, socklen_t(sizeof(*addr))) == -1) {
+    auto err = error_from_errno();
+    ::close(*sock);
+    return err;
+  }
+
+  return sock;
+}
+
+Result<int,std::error_code> bc::sys::listen_unix(const std::string &path) {
+  auto addr = unix_address(path);
+  if (!addr) {
+    return addr.get_error();
+  }
+
+  auto sock = unix_socket();
+  if (!sock) {
+    return sock;
+  }
+
+  /// Connecting needs write permission on the socket file, which bind creates according to the umask.
+  /// Clients can make us open any path with our privileges, so nobody but us gets to connect.
+  auto bind_private = [&]() {
+    const mode_t old_mask = ::umask(0177);
+    int ret = ::bind(*sock, (const sockaddr*) &*addr, sizeof(*addr));
+    const int err = errno;
+    ::umask(old_mask);
+    errno = err;
+    return ret;
+  };
+
+  int ret = bind_private();
+
+  if (ret == -1 && errno == EADDRINUSE) {
+    /// Only replace the socket file if nobody is listening on it anymore.
+    auto probe = connect_unix(path);
+
+    if (probe) {
+      ::close(*probe);
+      errno = EADDRINUSE;
+    } else if (probe.get_error() == std::errc::connection_refused) {
+      ::unlink(path.c_str());
+      ret = bind_private();
+    } else {
+      errno = EADDRINUSE;
+    }
+  }
+
+  if (ret == -1 || ::listen(*sock, SOMAXCONN) == -1) {
+    auto err = error_from_errno();
+    ::close(*sock);
+    return err;
+  }
+
+  return sock;
+}
+
+Result<int,std::error_code> bc::sys::accept(int sock) {
+  int fd = retry_after_signal(-1, ::accept, sock, nullptr, nullptr);
+  if (fd == -1) {
+    return error_from_errno();
+  }
+
+  {
+    int r = fcntl(fd, F_SETFD, FD_CLOEXEC);
+    (void)r;
+    assert(r == 0 && "fcntl(F_SETFD, FD_CLOEXEC) failed");
+  }
+
+  return fd;
+}
+
+Result<uint32_t,std::error_code> bc::sys::peer_uid(int sock) {
+#if defined(SO_PEERCRED)
+  ucred cred;
+  socklen_t len = sizeof(cred);
+
+  if (::getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+    return error_from_errno();
+  }
+  return uint32_t(cred.uid);
+#else
+  uid_t uid;
+  gid_t gid;
+
+  if (::getpeereid(sock, &uid, &gid) == -1) {
+    return error_from_errno();
+  }
+  return uint32_t(uid);
+#endif
+}
+
+uint32_t bc::sys::get_uid() {
+  return uint32_t(::getuid());
+}
+
+Result<std::nullopt_t,std::error_code> bc::sys::set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    return error_from_errno();
+  }
+  return std::nullopt;
+}
+
+Result<std::nullopt_t,std::error_code> bc::sys::send(int sock, size_t size, const uint8_t *data, const std::vector<int> &fds) {
+  assert(size > 0 && "need at least one byte to pass file descriptors along with");
+
+  if (fds.size() > MAX_FDS_PER_MSG) {
+    return std::make_error_code(std::errc::argument_list_too_long);
+  }
+
+  int flags = 0;
+#if defined(MSG_NOSIGNAL)
+  flags |= MSG_NOSIGNAL;
+#endif
+
+  alignas(cmsghdr) char control[CMSG_SPACE(MAX_FDS_PER_MSG * sizeof(int))];
+
+  bool pass_fds = !fds.empty();
+
+  while (size > 0) {
+    iovec iov;
+    iov.iov_base = (void*) data;
+    iov.iov_len  = size;
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = &iov;
+    msg.msg_iovlen = 1;
+
+    /// file descriptors go along with the first byte we send
+    if (pass_fds) {
+      memset(control, 0, sizeof(control));
+      msg.msg_control    = control;
+      msg.msg_controllen = CMSG_SPACE(fds.size() * sizeof(int));
+
+      cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type  = SCM_RIGHTS;
+      cmsg->cmsg_len   = CMSG_LEN(fds.size() * sizeof(int));
+      memcpy(CMSG_DATA(cmsg), fds.data(), fds.size() * sizeof(int));
+    }
+
+    ssize_t sent = retry_after_signal(-1, ::sendmsg, sock, (const msghdr*) &msg, flags);
+    if (sent == -1) {
+      return error_from_errno();
+    }
+
+    data    += sent;
+    size    -= sent;
+    pass_fds = false;
+  }
+
+  return std::nullopt;
+}
+
+Result<size_t,std::error_code> bc::sys::recv(int sock, size_t size, uint8_t *data, std::vector<int> &fds) {
+  alignas(cmsghdr) char control[CMSG_SPACE(MAX_FDS_PER_MSG * sizeof(int))];
+
+  iovec iov;
+  iov.iov_base = (void*) data;
+  iov.iov_len  = size;
+
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control;
+  msg.msg_controllen = sizeof(control);
+
+  int flags = 0;
+#if defined(MSG_CMSG_CLOEXEC)
+  flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+  ssize_t received = retry_after_signal(-1, ::recvmsg, sock, &msg, flags);
+  if (received == -1) {
+    return error_from_errno();
+  }
+
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+
+    const size_t num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+    for (size_t i = 0; i < num_fds; i++) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+#if !defined(MSG_CMSG_CLOEXEC)
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+      fds.push_back(fd);
+    }
+  }
+
+  if (msg.msg_flags & MSG_CTRUNC) {
+    return std::make_error_code(std::errc::message_size);
+  }
+
+  return size_t(received);
+}
+
+Result<size_t,std::error_code> bc::sys::send_some(int sock, size_t size, const uint8_t *data) {
+  int flags = 0;
+#if defined(MSG_NOSIGNAL)
+  flags |= MSG_NOSIGNAL;
+#endif
+
+  ssize_t sent = retry_after_signal(-1, ::send, sock, (const void*) data, size, flags);
+  if (sent == -1) {
+    return error_from_errno();
+  }
+  return size_t(sent);
+}
+
+Result<std::nullopt_t,std::error_code> bc::sys::wait_ready(std::vector<Poll_Fd> &fds) {
+  std::vector<pollfd> pfds(fds.size());
+
+  for (size_t i = 0; i < fds.size(); i++) {
+    pfds[i].fd      = fds[i].fd;
+    pfds[i].events  = short((fds[i].want_read ? POLLIN : 0) | (fds[i].want_write ? POLLOUT : 0));
+    pfds[i].revents = 0;
+  }
+
+  int ret = retry_after_signal(-1, ::poll, pfds.data(), nfds_t(pfds.size()), -1);
+  if (ret == -1) {
+    return error_from_errno();
+  }
+
+  for (size_t i = 0; i < pfds.size(); i++) {
+    const bool failed = pfds[i].revents & (POLLHUP | POLLERR);
+
+    fds[i].readable = fds[i].want_read  && ((pfds[i].revents & POLLIN)  || failed);
+    fds[i].writable = fds[i].want_write && ((pfds[i].revents & POLLOUT) || failed);
+  }
+
+  return std::nullopt;
+}
+
+Result<std::string,std::error_code> bc::sys::get_hostname() {
+  char name[256];
+
+  if (::gethostname(name, sizeof(name)) == -1) {
+    return error_from_errno();
+  }
+  name[sizeof(name) - 1] = '\0';
+
+  return std::string{name};
+}
+
+/// ***** asynchronous I/O
+
+#if BC_HAVE_IO_URING
+
+/// Pointers into the rings shared with the kernel.
+/// Heads & tails are written by one side and read by the other, hence the atomics.
+struct bc::sys::Io_Ring final {
+  int fd;
+  /// written to by io_ring_wake(), polled next to fd by io_ring_wait()
+  int wake_fd;
+
+  void  *sq_ptr;
+  size_t sq_size;
+  void  *cq_ptr;
+  size_t cq_size;
+  void  *sqes_ptr;
+  size_t sqes_size;
+
+  unsigned     *sq_head;
+  unsigned     *sq_tail;
+  unsigned      sq_mask;
+  unsigned      sq_entries;
+  unsigned     *sq_array;
+  io_uring_sqe *sqes;
+
+  unsigned     *cq_head;
+  unsigned     *cq_tail;
+  unsigned      cq_mask;
+  io_uring_cqe *cqes;
+
+  /// submissions come from any thread
+  std::mutex submit_mutex;
+};
+
+static void unmap_ring(Io_Ring *ring) {
+  if (ring->sqes_ptr) {
+    ::munmap(ring->sqes_ptr, ring->sqes_size);
+  }
+  if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr) {
+    ::munmap(ring->cq_ptr, ring->cq_size);
+  }
+  if (ring->sq_ptr) {
+    ::munmap(ring->sq_ptr, ring->sq_size);
+  }
+}
+
+static void *map_ring(int fd, size_t size, off_t offset) {
+  void *ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+  return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+Result<Io_Ring*,std::error_code> bc::sys::io_ring_create(unsigned entries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  int fd = int(::syscall(__NR_io_uring_setup, entries, &params));
+  if (fd < 0) {
+    return error_from_errno();
+  }
+
+  /// Anything before IORING_FEAT_NODROP (5.5) may lose completions, we don't want to deal with that.
+  /// IORING_OP_READ and reads from the current position (for pipes) came with IORING_FEAT_RW_CUR_POS (5.6).
+  if (!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_RW_CUR_POS)) {
+    ::close(fd);
+    return std::make_error_code(std::errc::function_not_supported);
+  }
+
+  int wake_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd < 0) {
+    std::error_code err = error_from_errno();
+    ::close(fd);
+    return err;
+  }
+
+  Io_Ring *ring = new Io_Ring{};
+  ring->fd        = fd;
+  ring->wake_fd   = wake_fd;
+  ring->sq_size   = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_size   = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+  /// since 5.4 both rings come in one mapping
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->sq_size = ring->cq_size = std::max(ring->sq_size, ring->cq_size);
+  }
+
+  ring->sq_ptr = map_ring(fd, ring->sq_size, IORING_OFF_SQ_RING);
+  if (ring->sq_ptr) {
+    ring->cq_ptr = (params.features & IORING_FEAT_SINGLE_MMAP) ? ring->sq_ptr : map_ring(fd, ring->cq_size, IORING_OFF_CQ_RING);
+  }
+  if (ring->cq_ptr) {
+    ring->sqes_ptr = map_ring(fd, ring->sqes_size, IORING_OFF_SQES);
+  }
+
+  if (!ring->sqes_ptr) {
+    std::error_code err = error_from_errno();
+    unmap_ring(ring);
+    ::close(wake_fd);
+    ::close(fd);
+    delete ring;
+    return err;
+  }
+
+  uint8_t *sq = (uint8_t*) ring->sq_ptr;
+  uint8_t *cq = (uint8_t*) ring->cq_ptr;
+
+  ring->sq_head    = (unsigned*) (sq + params.sq_off.head);
+  ring->sq_tail    = (unsigned*) (sq + params.sq_off.tail);
+  ring->sq_mask    = *(unsigned*) (sq + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->sq_array   = (unsigned*) (sq + params.sq_off.array);
+  ring->sqes       = (io_uring_sqe*) ring->sqes_ptr;
+
+  ring->cq_head = (unsigned*) (cq + params.cq_off.head);
+  ring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+  ring->cq_mask = *(unsigned*) (cq + params.cq_off.ring_mask);
+  ring->cqes    = (io_uring_cqe*) (cq + params.cq_off.cqes);
+
+  return ring;
+}
+
+void bc::sys::io_ring_destroy(Io_Ring *ring) {
+  unmap_ring(ring);
+  ::close(ring->wake_fd);
+  ::close(ring->fd);
+  delete ring;
+}
+
+/// fill in the next submission queue entry and hand it to the kernel
+template<typename Fill>
+static Result<std::nullopt_t,std::error_code> io_ring_submit(Io_Ring *ring, const Fill &fill) {
+  std::lock_guard<std::mutex> lock{ring->submit_mutex};
+
+  const unsigned tail = *ring->sq_tail;
+  const unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+  /// every entry is submitted (or taken back) right away, so the queue is never full
+  if (tail - head >= ring->sq_entries) {
+    return std::make_error_code(std::errc::resource_unavailable_try_again);
+  }
+
+  const unsigned index = tail & ring->sq_mask;
+
+  io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  fill(sqe);
+
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  /// Without SQPOLL the kernel only takes entries during io_uring_enter() with to_submit > 0, which only
+  /// happens here, under the lock. So once enter is back the head tells us for sure if it took our entry,
+  /// and if it didn't we can take it back without the kernel ever seeing it.
+  /// The kernel pushes back with EAGAIN/EBUSY while it is short on memory or completions, they get
+  /// reaped by whoever waits so we try again. But not forever, nobody may be waiting any more.
+  const int MAX_ATTEMPTS = 1000;
+
+  int error = EAGAIN;
+  for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+    const int ret = int(::syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, nullptr, 0));
+    error = ret < 0 ? errno : EAGAIN;
+
+    if (__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) != tail) {
+      return std::nullopt;
+    }
+
+    if (error != EINTR && error != EAGAIN && error != EBUSY) {
+      break;
+    }
+
+    sched_yield();
+  }
+
+  __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+  return std::error_code(error, std::generic_category());
+}
+
+Result<std::nullopt_t,std::error_code> bc::sys::io_ring_read(Io_Ring *ring, int fd, size_t count, int64_t offset,
+                                                             uint8_t *buf, uint64_t user_data) {
+  return io_ring_submit(ring, [&](io_uring_sqe *sqe) {
+    sqe->opcode    = IORING_OP_READ;
+    sqe->fd        = fd;
+    sqe->off       = uint64_t(offset);
+    sqe->addr      = uint64_t(uintptr_t(buf));
+    /// reads are limited to a bit under 2 GiB anyway
+    sqe->len       = unsigned(std::min<size_t>(count, 0x7ffff000));
+    sqe->user_data = user_data;
+  });
+}
+
+void bc::sys::io_ring_wake(Io_Ring *ring) {
+  /// only fails if the counter would overflow, and then a wake up is pending anyway
+  const uint64_t one = 1;
+  ssize_t ret = retry_after_signal(-1, ::write, ring->wake_fd, (const void*) &one, sizeof(one));
+  (void) ret;
+}
+
+Result<size_t,std::error_code> bc::sys::io_ring_wait(Io_Ring *ring, size_t max, Io_Completion *completions) {
+  while (true) {
+    unsigned       head = *ring->cq_head;
+    const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    size_t num = 0;
+    for (; head != tail && num < max; head++, num++) {
+      const io_uring_cqe &cqe = ring->cqes[head & ring->cq_mask];
+
+      completions[num].user_data = cqe.user_data;
+      completions[num].bytes     = cqe.res >= 0 ? size_t(cqe.res) : 0;
+      completions[num].error     = cqe.res >= 0 ? std::error_code{} : std::error_code(-cqe.res, std::generic_category());
+    }
+
+    if (num > 0) {
+      __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+      return num;
+    }
+
+    /// the ring fd is readable while there are completions, so we can wait for them and wake ups at once
+    pollfd pfds[2];
+    memset(pfds, 0, sizeof(pfds));
+    pfds[0].fd     = ring->fd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd     = ring->wake_fd;
+    pfds[1].events = POLLIN;
+
+    int ret = retry_after_signal(-1, ::poll, &pfds[0], nfds_t(2), -1);
+    if (ret == -1) {
+      return error_from_errno();
+    }
+
+    if (pfds[1].revents & POLLIN) {
+      uint64_t count;
+      ssize_t got = ::read(ring->wake_fd, &count, sizeof(count));
+      (void) got;
+      return 0;
+    }
+  }
+}
+
+#else
+
+struct bc::sys::Io_Ring final {};
+
+Result<Io_Ring*,std::error_code> bc::sys::io_ring_create(unsigned) {
+  return std::make_error_code(std::errc::function_not_supported);
+}
+
+void bc::sys::io_ring_destroy(Io_Ring *ring) {
+  delete ring;
+}
+
+Result<std::nullopt_t,std::error_code> bc::sys::io_ring_read(Io_Ring*, int, size_t, int64_t, uint8_t*, uint64_t) {
+  return std::make_error_code(std::errc::function_not_supported);
+}
+
+void bc::sys::io_ring_wake(Io_Ring*) {}
+
+Result<size_t,std::error_code> bc::sys::io_ring_wait(Io_Ring*, size_t, Io_Completion*) {
+  return std::make_error_code(std::errc::function_not_supported);
+}
+
+#endif
@@ -2,10 +2,11 @@
 #pragma once
 
 #include "result.hpp"   // bc::Result
-#include <cstdint>      // uint8_t
+#include <cstdint>      // uint8_t, uint64_t, int64_t
 #include <optional>     // std::nullopt_t
 #include <string>       // std::string
 #include <system_error> // std::error_code
+#include <vector>       // std::vector
 
 namespace bc::sys {
 
@@ -14,10 +15,26 @@ namespace bc::sys {
 /// get system memory page size
 Result<size_t,std::error_code> get_page_size();
 
+/// get the name of this machine
+Result<std::string,std::error_code> get_hostname();
+
+/// ***** memory
+
+/// size of the huge pages we ask for
+const constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+/// map anonymous memory backed by explicit huge pages (MAP_HUGETLB),
+/// fails if the admin hasn't reserved any. length must be a multiple of HUGE_PAGE_SIZE.
+Result<void*,std::error_code> mmap_huge(size_t length);
+
+/// ask for transparent huge pages for a range of memory (MADV_HUGEPAGE)
+Result<std::nullopt_t,std::error_code> advise_huge(void *addr, size_t length);
+
 /// ***** file system
 
-/// open file, readonly
-Result<int,std::error_code> open(const std::string &file);
+/// open file, readonly.
+/// With nonblocking (O_NONBLOCK) opening a FIFO doesn't wait for a writer, and reading from one doesn't wait for data.
+Result<int,std::error_code> open(const std::string &file, bool nonblocking = false);
 
 /// close file
 Result<std::nullopt_t,std::error_code> close(int fd);
@@ -25,8 +42,30 @@ Result<std::nullopt_t,std::error_code> close(int fd);
 /// read chunk from file
 Result<ssize_t,std::error_code> read(int fd, size_t count, uint8_t *buf);
 
-/// map entire file into memory, readonly
-Result<void*,std::error_code> mmap(int fd, size_t length);
+/// read chunk from file at offset, without moving the file position
+Result<ssize_t,std::error_code> pread(int fd, size_t count, size_t offset, uint8_t *buf);
+
+/// current file position, fails with invalid_seek for pipes, sockets & co
+Result<size_t,std::error_code> tell(int fd);
+
+/// move the file position to offset
+Result<std::nullopt_t,std::error_code> seek(int fd, size_t offset);
+
+/// flags for mmap()
+enum Mmap_Flags : unsigned {
+  MMAP_DEFAULT  = 0,
+  /// fault in the whole mapping up front, instead of page by page while counting
+  MMAP_POPULATE = 1 << 0,
+  /// ask for transparent huge pages (MADV_HUGEPAGE), fewer TLB misses on big mappings
+  MMAP_HUGE     = 1 << 1,
+};
+
+/// map entire file into memory, readonly.
+/// Flags are best effort, if the system doesn't support them we map without.
+Result<void*,std::error_code> mmap(int fd, size_t length, unsigned flags = MMAP_DEFAULT);
+
+/// fault in a readable mapping, MADV_POPULATE_READ where the kernel has it, touching every page otherwise
+void populate_read(const void *mapping, size_t length);
 
 Result<std::nullopt_t,std::error_code> munmap(void*, size_t length);
 
@@ -39,9 +78,124 @@ struct Stat {
   };
 
   File_Type type;
+  /// for block devices, the size of the device
   size_t    size;
 };
 
 Result<Stat,std::error_code> stat(int fd);
 
+/// create and open (read/write) a new uniquely named file in dir, its name is stored in path
+Result<int,std::error_code> create_temp_file(const std::string &dir, std::string &path);
+
+/// write all of buffer to file
+Result<std::nullopt_t,std::error_code> write(int fd, size_t count, const uint8_t *buf);
+
+/// flush file to disk and evict it from the page cache (as far as the OS lets us)
+Result<std::nullopt_t,std::error_code> drop_cache(int fd);
+
+/// delete a file
+Result<std::nullopt_t,std::error_code> unlink(const std::string &path);
+
+/// ***** signals
+
+enum class Signal {
+  INTERRUPT, /// SIGINT
+  USER1,     /// SIGUSR1
+};
+
+/// Stop a signal from doing its default thing (e.g. killing us), just remember that it arrived
+Result<std::nullopt_t,std::error_code> catch_signal(Signal sig);
+
+/// true if the signal arrived since the last call
+bool take_signal(Signal sig);
+
+/// ***** NUMA
+
+/// ids of NUMA nodes with memory, just {0} if the system (or this build) has no NUMA support
+std::vector<int> numa_nodes();
+
+/// restrict the calling thread to the CPUs of a NUMA node
+Result<std::nullopt_t,std::error_code> numa_run_on_node(int node);
+
+/// find the NUMA node each page resides on, -1 for pages that are not mapped (yet)
+Result<std::nullopt_t,std::error_code> numa_page_nodes(size_t count, const void **pages, int *nodes);
+
+/// ***** unix domain sockets
+
+/// create a stream socket listening at path, only the current user may connect to it (mode 0600).
+/// A stale socket file left behind by a server that is no longer running is replaced.
+Result<int,std::error_code> listen_unix(const std::string &path);
+
+/// connect a stream socket to path
+Result<int,std::error_code> connect_unix(const std::string &path);
+
+/// accept a connection on a listening socket
+Result<int,std::error_code> accept(int sock);
+
+/// uid of the process on the other end of a connected unix domain socket
+Result<uint32_t,std::error_code> peer_uid(int sock);
+
+/// uid of this process
+uint32_t get_uid();
+
+/// make reads & writes on fd fail with resource_unavailable_try_again instead of blocking
+Result<std::nullopt_t,std::error_code> set_nonblocking(int fd);
+
+/// send all of data, the file descriptors in fds are passed along with it (SCM_RIGHTS)
+Result<std::nullopt_t,std::error_code> send(int sock, size_t size, const uint8_t *data, const std::vector<int> &fds);
+
+/// receive up to size bytes, file descriptors passed along with them are appended to fds.
+/// Returns 0 on EOF.
+Result<size_t,std::error_code> recv(int sock, size_t size, uint8_t *data, std::vector<int> &fds);
+
+/// send as much of data as the socket takes without blocking, returns how much that was
+Result<size_t,std::error_code> send_some(int sock, size_t size, const uint8_t *data);
+
+/// a file descriptor for wait_ready(), what we wait for and what we got
+struct Poll_Fd {
+  int  fd;
+  bool want_read  = false;
+  bool want_write = false;
+  /// also set if the peer hung up or there is an error, the next read or write tells which
+  bool readable   = false;
+  bool writable   = false;
+};
+
+/// block until at least one of fds is ready for what it wants
+Result<std::nullopt_t,std::error_code> wait_ready(std::vector<Poll_Fd> &fds);
+
+/// ***** asynchronous I/O
+
+/// An io_uring (Linux 5.6 or newer), set up with raw syscalls so we don't depend on liburing.
+struct Io_Ring;
+
+/// a read submitted to an Io_Ring that is done
+struct Io_Completion {
+  uint64_t        user_data;
+  /// bytes read, if there is no error
+  size_t          bytes;
+  std::error_code error;
+};
+
+/// offset for io_ring_read() to read from the current file position, e.g. for pipes
+const constexpr int64_t IO_CURRENT_POSITION = -1;
+
+/// fails with function_not_supported if the system (or this build) has no io_uring
+Result<Io_Ring*,std::error_code> io_ring_create(unsigned entries);
+
+/// all submissions must be completed before
+void io_ring_destroy(Io_Ring *ring);
+
+/// submit a read of up to count bytes at offset, buf must stay valid until it completes.
+/// If this fails the read was not submitted and never completes. Can be called from any thread.
+Result<std::nullopt_t,std::error_code> io_ring_read(Io_Ring *ring, int fd, size_t count, int64_t offset,
+                                                    uint8_t *buf, uint64_t user_data);
+
+/// make io_ring_wait() return right away, even if nothing completed. Can be called from any thread.
+void io_ring_wake(Io_Ring *ring);
+
+/// block until at least one submission is done (or io_ring_wake() is called), store up to max completions.
+/// Returns 0 if we were woken up without anything to hand out. Only one thread may wait at a time.
+Result<size_t,std::error_code> io_ring_wait(Io_Ring *ring, size_t max, Io_Completion *completions);
+
 } // end namespace bc::sys
@@ -0,0 +1,250 @@
+
+#include "tar.hpp"
+#include <algorithm> // std::min
+#include <cstdlib>   // strtoull
+#include <cstring>   // memcmp
+
+using namespace bc;
+
+/// Metadata payloads are file names & such, anything bigger than this is not an archive we want to read
+static constexpr size_t MAX_META_SIZE = 1024 * 1024;
+
+/// offsets & sizes of header fields
+static constexpr size_t NAME_OFFSET   = 0;
+static constexpr size_t NAME_SIZE     = 100;
+static constexpr size_t SIZE_OFFSET   = 124;
+static constexpr size_t SIZE_SIZE     = 12;
+static constexpr size_t CHKSUM_OFFSET = 148;
+static constexpr size_t CHKSUM_SIZE   = 8;
+static constexpr size_t TYPE_OFFSET   = 156;
+static constexpr size_t MAGIC_OFFSET  = 257;
+static constexpr size_t PREFIX_OFFSET = 345;
+static constexpr size_t PREFIX_SIZE   = 155;
+
+static Error tar_error(const std::string &msg) {
+  return Error{std::make_error_code(std::errc::invalid_argument), msg};
+}
+
+/// string from a NUL terminated (unless it fills the whole field) header field
+static std::string field_string(const uint8_t *field, size_t size) {
+  size_t len = 0;
+  while (len < size && field[len] != '\0') {
+    len++;
+  }
+  return std::string{(const char*) field, len};
+}
+
+/// numeric fields are octal, or big endian binary if the high bit of the first byte is set (GNU, for big files)
+static bool field_number(const uint8_t *field, size_t size, size_t &out) {
+  out = 0;
+
+  if (field[0] & 0x80) {
+    out = field[0] & 0x7f;
+    for (size_t i = 1; i < size; i++) {
+      if (out >> 56) {
+        return false;
+      }
+      out = (out << 8) | field[i];
+    }
+    return true;
+  }
+
+  size_t i = 0;
+  while (i < size && field[i] == ' ') {
+    i++;
+  }
+
+  for (; i < size && field[i] != '\0' && field[i] != ' '; i++) {
+    if (field[i] < '0' || field[i] > '7' || (out >> 61)) {
+      return false;
+    }
+    out = out * 8 + (field[i] - '0');
+  }
+
+  return true;
+}
+
+/// the checksum is the sum of all header bytes, with the checksum field itself counted as spaces.
+/// Some old tars summed signed chars, accept those too.
+static bool checksum_ok(const uint8_t *block) {
+  size_t want;
+  if (!field_number(block + CHKSUM_OFFSET, CHKSUM_SIZE, want)) {
+    return false;
+  }
+
+  size_t   sum_unsigned = 0;
+  long     sum_signed   = 0;
+
+  for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+    const bool in_chksum = (i >= CHKSUM_OFFSET && i < CHKSUM_OFFSET + CHKSUM_SIZE);
+    const uint8_t byte   = in_chksum ? ' ' : block[i];
+
+    sum_unsigned += byte;
+    sum_signed   += (signed char) byte;
+  }
+
+  return want == sum_unsigned || long(want) == sum_signed;
+}
+
+Result<Tar_Parser::Action, Error> bc::Tar_Parser::header(const uint8_t *block) {
+  {
+    bool all_zero = true;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE && all_zero; i++) {
+      all_zero = (block[i] == 0);
+    }
+    if (all_zero) {
+      return END;
+    }
+  }
+
+  if (!checksum_ok(block)) {
+    return tar_error("bad tar header checksum");
+  }
+
+  if (!field_number(block + SIZE_OFFSET, SIZE_SIZE, _size)) {
+    return tar_error("bad size in tar header");
+  }
+
+  const char type = char(block[TYPE_OFFSET]);
+
+  switch (type) {
+  case 'L':
+    _meta_kind = GNU_LONG_NAME;
+    break;
+  case 'x':
+    _meta_kind = PAX;
+    break;
+  default:
+    break;
+  }
+
+  if (type == 'L' || type == 'x') {
+    if (_size > MAX_META_SIZE) {
+      return tar_error("tar metadata too big");
+    }
+    return READ_META;
+  }
+
+  /// global pax headers & GNU long link names, we don't care about either
+  if (type == 'g' || type == 'K') {
+    return SKIP;
+  }
+
+  /// this is a real header, apply what the metadata headers before it said
+  if (_has_next_size) {
+    _size = _next_size;
+  }
+
+  if (!_next_name.empty()) {
+    _name = _next_name;
+  } else {
+    _name = field_string(block + NAME_OFFSET, NAME_SIZE);
+
+    /// POSIX ustar splits long names into prefix & name, GNU tar uses the prefix bytes for other things
+    if (!memcmp(block + MAGIC_OFFSET, "ustar\0", 6)) {
+      const std::string prefix = field_string(block + PREFIX_OFFSET, PREFIX_SIZE);
+
+      if (!prefix.empty()) {
+        _name = prefix + "/" + _name;
+      }
+    }
+  }
+
+  _next_name.clear();
+  _has_next_size = false;
+
+  /// regular files, old style regular files & contiguous files
+  if (type == '0' || type == '\0' || type == '7') {
+    return COUNT;
+  }
+
+  /// directories, links, devices, ...
+  /// hard links ('1') have a payload size of 0 in practice, the data is stored with the link target
+  return SKIP;
+}
+
+void bc::Tar_Parser::meta(const std::string &payload) {
+  if (_meta_kind == GNU_LONG_NAME) {
+    _next_name = payload.substr(0, payload.find('\0'));
+    return;
+  }
+
+  /// pax records look like "<length> <key>=<value>\n", where length includes everything
+  size_t pos = 0;
+  while (pos < payload.size()) {
+    const size_t space = payload.find(' ', pos);
+    if (space == std::string::npos) {
+      break;
+    }
+
+    const size_t len = strtoull(payload.c_str() + pos, nullptr, 10);
+    if (len == 0 || pos + len > payload.size()) {
+      break;
+    }
+
+    /// key=value without the trailing newline
+    const std::string record = payload.substr(space + 1, pos + len - space - 2);
+    const size_t      eq     = record.find('=');
+
+    if (eq != std::string::npos) {
+      const std::string key   = record.substr(0, eq);
+      const std::string value = record.substr(eq + 1);
+
+      if (key == "path") {
+        _next_name = value;
+      } else if (key == "size") {
+        _next_size     = strtoull(value.c_str(), nullptr, 10);
+        _has_next_size = true;
+      }
+    }
+
+    pos += len;
+  }
+}
+
+Result<std::vector<Tar_Member>, Error> bc::tar_members(size_t size, const uint8_t *data) {
+  std::vector<Tar_Member> members;
+  Tar_Parser              parser;
+
+  size_t pos = 0;
+
+  /// archives that stop without end blocks are fine, archives that stop in the middle of a header are not
+  while (pos < size) {
+    if (size - pos < TAR_BLOCK_SIZE) {
+      return tar_error("truncated tar header");
+    }
+
+    auto action = parser.header(data + pos);
+    if (!action) {
+      return tar_error(action.get_error().msg + " at offset " + std::to_string(pos));
+    }
+    if (*action == Tar_Parser::END) {
+      break;
+    }
+
+    pos += TAR_BLOCK_SIZE;
+
+    if (parser.size() > size - pos) {
+      return tar_error("truncated tar member at offset " + std::to_string(pos));
+    }
+
+    switch (*action) {
+    case Tar_Parser::READ_META:
+      parser.meta(std::string{(const char*) data + pos, parser.size()});
+      break;
+    case Tar_Parser::COUNT:
+      members.push_back(Tar_Member{parser.name(), pos, parser.size()});
+      break;
+    case Tar_Parser::SKIP:
+    case Tar_Parser::END:
+      break;
+    }
+
+    if (tar_padded_size(parser.size()) > size - pos) {
+      return tar_error("truncated tar padding at offset " + std::to_string(pos + parser.size()));
+    }
+    pos += tar_padded_size(parser.size());
+  }
+
+  return members;
+}
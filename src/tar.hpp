@@ -0,0 +1,77 @@
+
+#pragma once
+
+#include "bitcnt.hpp" // bc::Count
+#include "error.hpp"  // bc::Error
+#include "result.hpp" // bc::Result
+#include <cstddef>    // size_t
+#include <cstdint>    // uint8_t
+#include <string>     // std::string
+#include <vector>     // std::vector
+
+namespace bc {
+
+/// tar archives are made of 512 byte blocks, every header is one and payloads are padded to a multiple of it
+const constexpr size_t TAR_BLOCK_SIZE = 512;
+
+/// size of a payload, including padding
+inline size_t tar_padded_size(size_t size) {
+  return (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+}
+
+/// Parses tar headers one at a time, so it works on mapped archives as well as on streams.
+/// Understands v7, ustar, GNU long names ('L') and pax 'path' & 'size' records.
+struct Tar_Parser final {
+  /// what to do with the payload following a header
+  enum Action {
+    COUNT,     /// a regular file, count it
+    SKIP,      /// not a regular file, skip size() bytes (+ padding)
+    READ_META, /// metadata for the next header, pass it to meta()
+    END,       /// end of archive
+  };
+
+  /// Parse the next 512 byte header block
+  Result<Action, Error> header(const uint8_t *block);
+
+  /// Payload of the last header if it returned READ_META
+  void meta(const std::string &payload);
+
+  /// name of the last header that returned COUNT
+  const std::string &name() const { return _name; }
+
+  /// size of the payload of the last header
+  size_t size() const { return _size; }
+private:
+  enum Meta_Kind {
+    GNU_LONG_NAME,
+    PAX,
+  };
+
+  std::string _name;
+  size_t      _size = 0;
+  Meta_Kind   _meta_kind = PAX;
+
+  /// set by metadata headers, apply to the next real header
+  std::string _next_name;
+  bool        _has_next_size = false;
+  size_t      _next_size     = 0;
+};
+
+/// A regular file in a tar archive
+struct Tar_Member final {
+  std::string name;
+  /// of the payload, from the start of the archive
+  size_t      offset;
+  size_t      size;
+};
+
+/// Bit count of a regular file in a tar archive
+struct Tar_Count final {
+  std::string name;
+  Count       count;
+};
+
+/// find all regular files in an archive that is completely in memory
+Result<std::vector<Tar_Member>, Error> tar_members(size_t size, const uint8_t *data);
+
+} // end namespace bc
@@ -0,0 +1,529 @@
+
+#include "tuning.hpp"
+#include "bc_openmp.hpp"
+#include "on_exit.hpp"
+#include "sys.hpp"
+#include <algorithm> // std::min, std::max
+#include <chrono>    // std::chrono::steady_clock
+#include <cstdlib>   // getenv, strtoull
+#include <cstring>   // memcpy
+#include <limits>    // std::numeric_limits
+#include <vector>    // std::vector
+
+using namespace bc;
+
+Tuning bc::Tuning::defaults(size_t page_size) {
+  Tuning t;
+  t.chunk_size     = 4 * page_size;
+  t.mmap_threshold = t.chunk_size;
+  return t;
+}
+
+std::string bc::default_tuning_path() {
+  if (const char *path = getenv("BC_TUNING_FILE")) {
+    return path;
+  }
+
+  const char *home = getenv("HOME");
+  return std::string{home ? home : "."} + "/.bitcounter-tuning";
+}
+
+/// ***** tuning file
+
+/// The tuning file is a list of 'key = value' lines, '#' starts a comment.
+
+static std::string trim(const std::string &str) {
+  const char *ws = " \t\r\n";
+
+  const size_t bgn = str.find_first_not_of(ws);
+  if (bgn == std::string::npos) {
+    return "";
+  }
+  const size_t end = str.find_last_not_of(ws);
+
+  return str.substr(bgn, end - bgn + 1);
+}
+
+static bool parse_size(const std::string &str, size_t &out) {
+  if (str.empty()) {
+    return false;
+  }
+
+  char *end = nullptr;
+  out = strtoull(str.c_str(), &end, 10);
+  return *end == '\0';
+}
+
+Result<Tuning, Error> bc::load_tuning(const std::string &path, size_t page_size) {
+  FILE *file = fopen(path.c_str(), "r");
+  if (!file) {
+    return Error{std::error_code(errno, std::generic_category()), "could not open tuning file " + escape(path)};
+  }
+  auto closer = on_exit([&]() { fclose(file); });
+
+  auto bad_line = [&](int line_no) {
+    return Error{std::make_error_code(std::errc::invalid_argument),
+                 escape(path) + ":" + std::to_string(line_no) + ": malformed tuning file"};
+  };
+
+  Tuning tuning = Tuning::defaults(page_size);
+
+  char buf[1024];
+  int  line_no = 0;
+
+  while (fgets(buf, sizeof(buf), file)) {
+    line_no++;
+
+    std::string line = buf;
+    line = trim(line.substr(0, line.find('#')));
+
+    if (line.empty()) {
+      continue;
+    }
+
+    const size_t eq = line.find('=');
+    if (eq == std::string::npos) {
+      return bad_line(line_no);
+    }
+
+    const std::string key = trim(line.substr(0, eq));
+    const std::string val = trim(line.substr(eq + 1));
+
+    size_t num;
+
+    if (key == "host") {
+      auto host = sys::get_hostname();
+
+      if (host && *host != val) {
+        return Error{std::make_error_code(std::errc::invalid_argument),
+                     "tuning file " + escape(path) + " was generated on host " + escape(val)};
+      }
+    } else if (key == "chunk_size" && parse_size(val, num) && num > 0) {
+      tuning.chunk_size = num;
+    } else if (key == "mmap_threshold" && parse_size(val, num)) {
+      tuning.mmap_threshold = num;
+    } else if (key == "threads" && parse_size(val, num) && num <= 4096) {
+      tuning.num_threads = int(num);
+    } else if (key == "huge_pages" && (val == "0" || val == "1")) {
+      tuning.huge_pages = (val == "1");
+    } else if (key == "populate" && (val == "0" || val == "1")) {
+      tuning.populate = (val == "1");
+    } else if (key == "kernel") {
+      bool found = false;
+
+      for (Kernel k : ALL_KERNELS) {
+        if (val == kernel_name(k) && kernel_available(k)) {
+          tuning.kernel = k;
+          found = true;
+        }
+      }
+
+      if (!found) {
+        return bad_line(line_no);
+      }
+    } else {
+      return bad_line(line_no);
+    }
+  }
+
+  if (ferror(file)) {
+    return Error{std::make_error_code(std::errc::io_error), "could not read tuning file " + escape(path)};
+  }
+
+  return tuning;
+}
+
+Result<std::nullopt_t, Error> bc::save_tuning(const std::string &path, const Tuning &tuning) {
+  FILE *file = fopen(path.c_str(), "w");
+  if (!file) {
+    return Error{std::error_code(errno, std::generic_category()), "could not create tuning file " + escape(path)};
+  }
+
+  auto host = sys::get_hostname();
+
+  fprintf(file, "# generated by bitcounter --autotune\n");
+  if (host) {
+    fprintf(file, "host           = %s\n", host->c_str());
+  }
+  fprintf(file, "chunk_size     = %zu\n", tuning.chunk_size);
+  fprintf(file, "mmap_threshold = %zu\n", tuning.mmap_threshold);
+  fprintf(file, "kernel         = %s\n",  kernel_name(tuning.kernel));
+  fprintf(file, "threads        = %d\n",  tuning.num_threads);
+  fprintf(file, "huge_pages     = %d\n",  int(tuning.huge_pages));
+  fprintf(file, "populate       = %d\n",  int(tuning.populate));
+
+  const bool failed = ferror(file);
+
+  if (fclose(file) != 0 || failed) {
+    return Error{std::make_error_code(std::errc::io_error), "could not write tuning file " + escape(path)};
+  }
+
+  return std::nullopt;
+}
+
+/// ***** autotuning
+
+/// Keeps the compiler from throwing away counts we only compute for timing
+static volatile size_t sink;
+
+/// Run every benchmark a couple of times and take the best time, to filter out noise
+static constexpr int REPETITIONS = 3;
+
+/// If a cheaper setting (smaller buffer, fewer threads) is at most this much slower, we take it.
+static constexpr double TOLERANCE = 1.05;
+
+template<typename Fn>
+static double time_seconds(Fn &&fn) {
+  const auto bgn = std::chrono::steady_clock::now();
+  fn();
+  const auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double>(end - bgn).count();
+}
+
+/// cheap pseudo random data, so there is nothing for the file system to compress or dedupe
+static void fill_random(size_t size, uint8_t *data, uint64_t &state) {
+  for (size_t i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    /// xorshift64
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+
+    memcpy(data + i, &state, sizeof(state));
+  }
+}
+
+static double gb_per_s(size_t bytes, double seconds) {
+  return bytes / seconds / 1e9;
+}
+
+/// stream the first limit bytes of a file through a chunk_size buffer
+static Result<double, Error> time_stream(const std::string &path, size_t chunk_size, size_t limit, Kernel kernel) {
+  auto fd = sys::open(path);
+  if (!fd) {
+    return Error{fd, "could not open scratch file " + escape(path)};
+  }
+  auto closer = on_exit([&]() { sys::close(*fd); });
+
+  Bitcount_Buffer buffer = Bitcount_Buffer::allocate(chunk_size);
+
+  std::error_code err;
+
+  const double secs = time_seconds([&]() {
+    size_t ones = 0;
+
+    for (size_t done = 0; done < limit;) {
+      auto ret = sys::read(*fd, std::min(chunk_size, limit - done), buffer.get());
+      if (!ret) {
+        err = ret.get_error();
+        return;
+      }
+      if (*ret == 0) {
+        break;
+      }
+
+      ones += bc::bitcount(*ret, buffer.get(), kernel).ones;
+      done += *ret;
+    }
+
+    sink = ones;
+  });
+
+  if (err) {
+    return Error{err, "error reading scratch file " + escape(path)};
+  }
+
+  return secs;
+}
+
+/// mmap the first limit bytes of a file and count them with num_threads threads
+static Result<double, Error> time_mmap(const std::string &path, size_t limit, Kernel kernel, int num_threads) {
+  auto fd = sys::open(path);
+  if (!fd) {
+    return Error{fd, "could not open scratch file " + escape(path)};
+  }
+  auto closer = on_exit([&]() { sys::close(*fd); });
+
+  std::error_code err;
+
+  const double secs = time_seconds([&]() {
+    auto mmap = sys::mmap(*fd, limit);
+    if (!mmap) {
+      err = mmap.get_error();
+      return;
+    }
+    auto unmapper = on_exit([&]() { sys::munmap(*mmap, limit); });
+
+    const uint8_t *data = (const uint8_t*) *mmap;
+
+    /// split into ranges that are big enough to amortize scheduling, and keep them 64 byte aligned
+    const size_t RANGE = 1024 * 1024;
+    const long num_ranges = long((limit + RANGE - 1) / RANGE);
+
+    size_t ones = 0;
+
+    BC_OMP(parallel for num_threads(num_threads) reduction(+: ones) schedule(dynamic))
+    for (long i = 0; i < num_ranges; i++) {
+      const size_t bgn = i * RANGE;
+      const size_t len = std::min(RANGE, limit - bgn);
+
+      ones += bc::bitcount(len, data + bgn, kernel).ones;
+    }
+
+    sink = ones;
+  });
+
+  if (err) {
+    return Error{err, "could not mmap scratch file " + escape(path)};
+  }
+
+  return secs;
+}
+
+/// Pretend the first limit bytes of a file are lots of small files and count them with num_threads threads,
+/// every "file" opened and streamed through a chunk_size buffer of its thread, like main() does for small files.
+static Result<double, Error> time_files(const std::string &path, size_t limit, size_t chunk_size, Kernel kernel, int num_threads) {
+  const size_t FILE_SIZE = 256 * 1024;
+  const long   num_files = long((limit + FILE_SIZE - 1) / FILE_SIZE);
+
+  std::vector<Bitcount_Buffer> buffers;
+  for (int i = 0; i < num_threads; i++) {
+    buffers.push_back(Bitcount_Buffer::allocate(chunk_size));
+  }
+
+  std::error_code err;
+
+  const double secs = time_seconds([&]() {
+    size_t ones = 0;
+
+    BC_OMP(parallel for num_threads(num_threads) reduction(+: ones) schedule(dynamic))
+    for (long i = 0; i < num_files; i++) {
+      Bitcount_Buffer &buffer = buffers[omp::thread_num()];
+
+      auto fd = sys::open(path);
+      if (!fd) {
+        BC_OMP(critical)
+        err = fd.get_error();
+        continue;
+      }
+
+      const size_t bgn = i * FILE_SIZE;
+      const size_t end = std::min(limit, bgn + FILE_SIZE);
+
+      for (size_t offset = bgn; offset < end;) {
+        auto ret = sys::pread(*fd, std::min(chunk_size, end - offset), offset, buffer.get());
+        if (!ret || *ret == 0) {
+          BC_OMP(critical)
+          err = ret ? std::make_error_code(std::errc::io_error) : ret.get_error();
+          break;
+        }
+
+        ones   += bc::bitcount(*ret, buffer.get(), kernel).ones;
+        offset += *ret;
+      }
+
+      sys::close(*fd);
+    }
+
+    sink = ones;
+  });
+
+  if (err) {
+    return Error{err, "error reading scratch file " + escape(path)};
+  }
+
+  return secs;
+}
+
+/// evict scratch file from the page cache so we measure the disk, not memcpy
+static void drop_cache(const std::string &path) {
+  auto fd = sys::open(path);
+  if (fd) {
+    sys::drop_cache(*fd);
+    sys::close(*fd);
+  }
+}
+
+Result<Tuning, Error> bc::autotune(const std::string &scratch_dir, size_t scratch_size, size_t page_size, FILE *log) {
+  Tuning tuning = Tuning::defaults(page_size);
+
+  /// *** create scratch file
+
+  std::string path;
+
+  auto fd = sys::create_temp_file(scratch_dir, path);
+  if (!fd) {
+    return Error{fd, "could not create scratch file in " + escape(scratch_dir)};
+  }
+  auto cleanup = on_exit([&]() {
+    sys::close(*fd);
+    sys::unlink(path);
+  });
+
+  const size_t WRITE_SIZE = 1024 * 1024;
+
+  scratch_size = std::max(WRITE_SIZE, scratch_size - scratch_size % WRITE_SIZE);
+
+  {
+    Bitcount_Buffer buffer = Bitcount_Buffer::allocate(WRITE_SIZE);
+    uint64_t state = 0x9e3779b97f4a7c15;
+
+    for (size_t done = 0; done < scratch_size; done += WRITE_SIZE) {
+      fill_random(WRITE_SIZE, buffer.get(), state);
+
+      auto ret = sys::write(*fd, WRITE_SIZE, buffer.get());
+      if (!ret) {
+        return Error{ret, "could not write scratch file " + escape(path)};
+      }
+    }
+  }
+
+  /// *** kernel, on data in memory
+
+  {
+    const size_t SIZE = std::min(scratch_size, size_t(16 * 1024 * 1024));
+
+    Bitcount_Buffer buffer = Bitcount_Buffer::allocate(SIZE);
+    uint64_t state = 42;
+    fill_random(SIZE, buffer.get(), state);
+
+    double best = std::numeric_limits<double>::infinity();
+
+    for (Kernel kernel : ALL_KERNELS) {
+      if (!kernel_available(kernel)) {
+        continue;
+      }
+
+      double secs = std::numeric_limits<double>::infinity();
+      for (int i = 0; i < REPETITIONS; i++) {
+        secs = std::min(secs, time_seconds([&]() { sink = bc::bitcount(SIZE, buffer.get(), kernel).ones; }));
+      }
+
+      if (log) {
+        fprintf(log, "autotune: kernel %-14s %8.2f GB/s\n", kernel_name(kernel), gb_per_s(SIZE, secs));
+      }
+
+      if (secs < best) {
+        best          = secs;
+        tuning.kernel = kernel;
+      }
+    }
+  }
+
+  /// *** chunk size, streaming from disk
+
+  {
+    double best = std::numeric_limits<double>::infinity();
+
+    for (size_t chunk_size = 4 * page_size; chunk_size <= std::min(scratch_size, size_t(16 * 1024 * 1024)); chunk_size *= 4) {
+      double secs = std::numeric_limits<double>::infinity();
+
+      for (int i = 0; i < REPETITIONS; i++) {
+        drop_cache(path);
+
+        auto t = time_stream(path, chunk_size, scratch_size, tuning.kernel);
+        if (!t) {
+          return t.get_error();
+        }
+        secs = std::min(secs, *t);
+      }
+
+      if (log) {
+        fprintf(log, "autotune: chunk size %10zu %8.2f GB/s\n", chunk_size, gb_per_s(scratch_size, secs));
+      }
+
+      /// sizes are increasing, so only switch if it's a clear win
+      if (secs * TOLERANCE < best) {
+        best              = secs;
+        tuning.chunk_size = chunk_size;
+      }
+    }
+  }
+
+  /// *** mmap vs stream threshold, on cached data
+
+  {
+    /// smallest size from which on mmap was never clearly slower, SIZE_MAX if it lost at the biggest size
+    size_t crossover = std::numeric_limits<size_t>::max();
+    size_t biggest   = 0;
+
+    for (size_t size = 4 * page_size; size <= std::min(scratch_size, size_t(64 * 1024 * 1024)); size *= 4) {
+      double stream = std::numeric_limits<double>::infinity();
+      double mmap   = std::numeric_limits<double>::infinity();
+
+      for (int i = 0; i < REPETITIONS; i++) {
+        auto s = time_stream(path, tuning.chunk_size, size, tuning.kernel);
+        if (!s) {
+          return s.get_error();
+        }
+        stream = std::min(stream, *s);
+
+        auto m = time_mmap(path, size, tuning.kernel, 1);
+        if (!m) {
+          return m.get_error();
+        }
+        mmap = std::min(mmap, *m);
+      }
+
+      if (log) {
+        fprintf(log, "autotune: file size %11zu stream %8.2f GB/s, mmap %8.2f GB/s\n",
+                size, gb_per_s(size, stream), gb_per_s(size, mmap));
+      }
+
+      biggest = size;
+
+      /// differences within noise are no reason to move away from the default, which is to mmap
+      if (stream * TOLERANCE < mmap) {
+        crossover = std::numeric_limits<size_t>::max();
+      } else if (crossover == std::numeric_limits<size_t>::max()) {
+        crossover = size;
+      }
+    }
+
+    /// Streaming still won at the biggest size we tried. Don't extrapolate that to all files:
+    /// past that, mmap is how big files get counted by the whole team, so we mmap those anyway.
+    if (crossover == std::numeric_limits<size_t>::max()) {
+      crossover = 4 * biggest;
+    }
+
+    tuning.mmap_threshold = std::max(tuning.mmap_threshold, crossover);
+  }
+
+  /// *** parallelism, counting lots of small files from disk, which is what num_threads is used for
+
+  {
+    double best = std::numeric_limits<double>::infinity();
+
+    /// powers of two, and the whole team even if it isn't one
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < omp::max_threads(); threads *= 2) {
+      thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(omp::max_threads());
+
+    for (int threads : thread_counts) {
+      double secs = std::numeric_limits<double>::infinity();
+
+      for (int i = 0; i < REPETITIONS; i++) {
+        drop_cache(path);
+
+        auto t = time_files(path, scratch_size, tuning.chunk_size, tuning.kernel, threads);
+        if (!t) {
+          return t.get_error();
+        }
+        secs = std::min(secs, *t);
+      }
+
+      if (log) {
+        fprintf(log, "autotune: threads %13d %8.2f GB/s\n", threads, gb_per_s(scratch_size, secs));
+      }
+
+      if (secs * TOLERANCE < best) {
+        best               = secs;
+        tuning.num_threads = threads;
+      }
+    }
+  }
+
+  return tuning;
+}
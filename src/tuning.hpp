@@ -0,0 +1,46 @@
+
+#pragma once
+
+#include "bitcnt.hpp" // bc::Kernel
+#include "error.hpp"  // bc::Error
+#include "result.hpp" // bc::Result
+#include <cstdio>     // FILE
+#include <optional>   // std::nullopt_t
+#include <string>     // std::string
+
+namespace bc {
+
+/// Knobs for File_Bit_Counter & friends. The best values depend a lot on the machine,
+/// so they can be measured once per host with autotune() and stored in a tuning file.
+struct Tuning final {
+  /// how much to read() at once when streaming
+  size_t chunk_size;
+  /// files at least this big are mmapped instead of streamed
+  size_t mmap_threshold;
+  /// popcount kernel
+  Kernel kernel = DEFAULT_KERNEL;
+  /// how many files to count in parallel, 0 means let OpenMP decide
+  int num_threads = 0;
+  /// back stream buffers with huge pages and ask for them on file mappings
+  bool huge_pages = false;
+  /// fault in file mappings up front (MAP_POPULATE)
+  bool populate = false;
+
+  /// what we use if there is no tuning file
+  static Tuning defaults(size_t page_size);
+};
+
+/// $BC_TUNING_FILE if set, ~/.bitcounter-tuning otherwise
+std::string default_tuning_path();
+
+/// Read a tuning file. Files generated on a different host are rejected.
+Result<Tuning, Error> load_tuning(const std::string &path, size_t page_size);
+
+Result<std::nullopt_t, Error> save_tuning(const std::string &path, const Tuning &tuning);
+
+/// Find the best tuning for this machine by running benchmarks on a scratch file of scratch_size bytes
+/// created in scratch_dir (which should be on the kind of disk you want to count files on).
+/// Progress is logged to log, if it is not null.
+Result<Tuning, Error> autotune(const std::string &scratch_dir, size_t scratch_size, size_t page_size, FILE *log);
+
+} // end namespace bc
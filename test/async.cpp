@@ -0,0 +1,170 @@
+
+#include "async.hpp"
+#include "bitcnt.hpp"
+#include "sys.hpp"
+#include <atomic>   // for std::atomic
+#include <cstdio>   // for fprintf
+#include <cstdlib>  // for getenv
+#include <memory>   // for std::unique_ptr
+#include <string>   // for std::to_string
+#include <thread>   // for std::thread, std::this_thread::yield
+#include <unistd.h> // for pipe
+
+using namespace bc;
+
+/// many counts in flight on a pool of two threads, they must all come out right
+static bool count_concurrently(Async_Reader &reader, const std::string &path, Count want) {
+  const int NUM_COUNTS = 32;
+
+  std::atomic<int> num_right{0};
+  std::atomic<int> num_done{0};
+
+  for (int i = 0; i < NUM_COUNTS; i++) {
+    /// small chunks, so every count takes a couple of reads
+    start<Result<Count, Error>>(async_bitcount(reader, path, 64 * 1024), [&](Result<Count, Error> cnt) {
+      if (!cnt) {
+        fprintf(stderr, "error: %s\n", cnt.get_error().message().c_str());
+      } else if (cnt->ones == want.ones && cnt->zeroes == want.zeroes) {
+        num_right++;
+      }
+      num_done++;
+    });
+  }
+
+  while (num_done != NUM_COUNTS) {
+    std::this_thread::yield();
+  }
+
+  if (num_right != NUM_COUNTS) {
+    fprintf(stderr, "%s: %d of %d counts are wrong\n", reader.name(), NUM_COUNTS - num_right.load(), NUM_COUNTS);
+    return false;
+  }
+  return true;
+}
+
+/// awaiting from another coroutine
+static Task<Result<Count, Error>> count_twice(Async_Reader &reader, std::string path) {
+  auto first = co_await async_bitcount(reader, path);
+  if (!first) {
+    co_return first;
+  }
+
+  auto second = co_await async_bitcount(reader, path);
+  if (!second) {
+    co_return second;
+  }
+
+  co_return *first + *second;
+}
+
+/// pipes can't be read at offsets, every read has to wait for the one before to move the position
+static bool count_pipe(Async_Reader &reader, size_t size, const uint8_t *data, Count want) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    fprintf(stderr, "could not create pipe\n");
+    return false;
+  }
+
+  /// more than fits into the pipe, so the writer has to wait for us
+  std::thread writer{[&]() {
+    if (!sys::write(fds[1], size, data)) {
+      fprintf(stderr, "could not write to pipe\n");
+    }
+    sys::close(fds[1]);
+  }};
+
+  auto cnt = sync_wait(async_bitcount(reader, "/dev/fd/" + std::to_string(fds[0]), 4096));
+
+  writer.join();
+  sys::close(fds[0]);
+
+  if (!cnt || cnt->ones != want.ones || cnt->zeroes != want.zeroes) {
+    fprintf(stderr, "%s: wrong count for a pipe: %s\n", reader.name(),
+            cnt ? "different bits" : cnt.get_error().message().c_str());
+    return false;
+  }
+  return true;
+}
+
+/// a read that fails must complete with its error, and only once
+static Task<Result<size_t, std::error_code>> read_bad_fd(Async_Reader &reader) {
+  uint8_t byte;
+  co_return co_await Async_Read{reader, -1, sizeof(byte), 0, &byte};
+}
+
+int main() {
+  const size_t SIZE = 1024 * 1024 + 12345;
+  Bitcount_Buffer buffer = Bitcount_Buffer::allocate(SIZE);
+
+  uint32_t state = 1;
+  for (size_t i = 0; i < SIZE; i++) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    buffer.get()[i] = uint8_t(state);
+  }
+
+  const char *tmp = getenv("TMPDIR");
+
+  std::string path;
+  auto fd = sys::create_temp_file(tmp ? tmp : "/tmp", path);
+  if (!fd) {
+    fprintf(stderr, "could not create temp file: %s\n", fd.get_error().message().c_str());
+    return 1;
+  }
+  auto remover = [&]() { sys::unlink(path); sys::close(*fd); };
+
+  if (!sys::write(*fd, SIZE, buffer.get())) {
+    fprintf(stderr, "could not write temp file\n");
+    remover();
+    return 1;
+  }
+
+  const Count want = bc::bitcount(SIZE, buffer.get());
+
+  bool ok = true;
+  {
+    Thread_Pool pool{2};
+
+    /// io_uring if this kernel lets us, blocking reads otherwise
+    std::unique_ptr<Async_Reader> readers[] = {Async_Reader::create(pool), Async_Reader::create_blocking(pool)};
+
+    for (auto &reader : readers) {
+      ok = ok && count_concurrently(*reader, path, want);
+      ok = ok && count_pipe(*reader, SIZE, buffer.get(), want);
+
+      auto twice = sync_wait(count_twice(*reader, path));
+      if (!twice || twice->ones != 2 * want.ones || twice->zeroes != 2 * want.zeroes) {
+        fprintf(stderr, "%s: wrong count when awaiting from a coroutine\n", reader->name());
+        ok = false;
+      }
+
+      auto missing = sync_wait(async_bitcount(*reader, path + ".does-not-exist"));
+      if (missing) {
+        fprintf(stderr, "%s: expected an error for a missing file\n", reader->name());
+        ok = false;
+      }
+
+      auto bad = sync_wait(read_bad_fd(*reader));
+      if (bad || bad.get_error() != std::errc::bad_file_descriptor) {
+        fprintf(stderr, "%s: expected EBADF for a bad fd\n", reader->name());
+        ok = false;
+      }
+    }
+
+    /// shutting down must never wait for anything
+    for (int i = 0; i < 100; i++) {
+      auto reader = Async_Reader::create(pool);
+    }
+  }
+
+  /// the default reader, for callers that don't care
+  auto cnt = sync_wait(async_bitcount(path));
+  if (!cnt || cnt->ones != want.ones || cnt->zeroes != want.zeroes) {
+    fprintf(stderr, "default reader: wrong count\n");
+    ok = false;
+  }
+
+  remover();
+  return ok ? 0 : 1;
+}
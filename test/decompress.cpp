@@ -0,0 +1,198 @@
+
+#include "bitcnt.hpp"
+#include "config.h"
+#include "decompress.hpp"
+#include "file_bit_counter.hpp"
+#include "sys.hpp"
+#include <algorithm> // for std::min
+#include <cstdio>    // for fprintf
+#include <cstdlib>   // for rand, getenv
+#include <string>    // for std::string
+#include <vector>    // for std::vector
+
+#if BC_HAVE_ZLIB
+#  include <zlib.h> // for deflateInit2, deflate, deflateEnd
+#endif
+
+#if BC_HAVE_LIBZSTD
+#  include <zstd.h> // for ZSTD_compress, ZSTD_compressBound
+#endif
+
+using namespace bc;
+
+#if BC_HAVE_ZLIB
+/// append data as one gzip member
+static void gzip(std::vector<uint8_t> &out, const std::vector<uint8_t> &data) {
+  z_stream stream{};
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+
+  std::vector<uint8_t> buffer(deflateBound(&stream, data.size()));
+
+  stream.next_in   = const_cast<Bytef*>(data.data());
+  stream.avail_in  = uInt(data.size());
+  stream.next_out  = buffer.data();
+  stream.avail_out = uInt(buffer.size());
+
+  deflate(&stream, Z_FINISH);
+  out.insert(out.end(), buffer.data(), buffer.data() + stream.total_out);
+  deflateEnd(&stream);
+}
+#endif
+
+#if BC_HAVE_LIBZSTD
+/// append data as one zstd frame
+static void zstd(std::vector<uint8_t> &out, const std::vector<uint8_t> &data) {
+  std::vector<uint8_t> buffer(ZSTD_compressBound(data.size()));
+
+  const size_t size = ZSTD_compress(buffer.data(), buffer.size(), data.data(), data.size(), 3);
+  out.insert(out.end(), buffer.data(), buffer.data() + size);
+}
+#endif
+
+/// decompress all of in, feeding it and taking the output a few bytes at a time
+static bool decompress_all(Decompressor &decompressor, const std::vector<uint8_t> &in, std::vector<uint8_t> &out) {
+  const size_t IN_STEP  = 13;
+  const size_t OUT_STEP = 7;
+
+  uint8_t buffer[OUT_STEP];
+
+  size_t in_used = 0;
+
+  for (size_t in_size = 0; in_size < in.size();) {
+    in_size = std::min(in.size(), in_size + IN_STEP);
+
+    while (true) {
+      auto got = decompressor.decompress(in_size, in.data(), in_used, sizeof(buffer), buffer);
+      if (!got) {
+        fprintf(stderr, "error: %s\n", got.get_error().msg.c_str());
+        return false;
+      }
+      if (*got == 0) {
+        break;
+      }
+      out.insert(out.end(), buffer, buffer + *got);
+    }
+
+    /// everything we have fed so far must be used up, unless there is output left
+    if (in_used != in_size) {
+      fprintf(stderr, "decompressor left %zu bytes of input\n", in_size - in_used);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// count compressed as a file, the way bitcounter --decompress does
+static Result<Count, Error> count_file(const std::vector<uint8_t> &compressed) {
+  const char *tmp = getenv("TMPDIR");
+
+  std::string path;
+  auto fd = sys::create_temp_file(tmp ? tmp : "/tmp", path);
+  if (!fd) {
+    return Error{fd, "could not create temp file"};
+  }
+  sys::unlink(path);
+
+  auto written = sys::write(*fd, compressed.size(), compressed.data());
+  if (!written) {
+    sys::close(*fd);
+    return Error{written, "could not write temp file"};
+  }
+  sys::seek(*fd, 0);
+
+  const File_Bit_Counter files{4096};
+
+  auto cnt = files.bitcount_decompressed(*fd, path);
+  sys::close(*fd);
+  return cnt;
+}
+
+/// two members or frames, decompressed piece by piece and counted as a file, then the same truncated
+static bool check_format(Compression compression, void (*compress)(std::vector<uint8_t>&, const std::vector<uint8_t>&)) {
+  const char *name = compression_name(compression);
+
+  std::vector<uint8_t> data(100000);
+  for (uint8_t &byte : data) {
+    byte = uint8_t(rand() % 4);
+  }
+
+  std::vector<uint8_t> compressed;
+  compress(compressed, data);
+  compress(compressed, data);
+
+  std::vector<uint8_t> want = data;
+  want.insert(want.end(), data.begin(), data.end());
+
+  auto decompressor = Decompressor::create(compression);
+  if (!decompressor) {
+    fprintf(stderr, "%s: %s\n", name, decompressor.get_error().msg.c_str());
+    return false;
+  }
+
+  std::vector<uint8_t> got;
+  if (!decompress_all(*decompressor.get_value(), compressed, got)) {
+    return false;
+  }
+
+  if (got != want || !decompressor.get_value()->complete()) {
+    fprintf(stderr, "%s: expected %zu bytes, got %zu\n", name, want.size(), got.size());
+    return false;
+  }
+
+  if (compression == Compression::ZSTD) {
+    auto frames = zstd_frames(compressed.size(), compressed.data());
+    if (!frames || frames->size() != 2) {
+      fprintf(stderr, "%s: expected 2 frames\n", name);
+      return false;
+    }
+  }
+
+  const Count want_cnt = bc::bitcount(want.size(), want.data());
+
+  auto cnt = count_file(compressed);
+  if (!cnt || cnt->ones != want_cnt.ones || cnt->zeroes != want_cnt.zeroes) {
+    fprintf(stderr, "%s: wrong count for file: %s\n", name, cnt ? "different bits" : cnt.get_error().message().c_str());
+    return false;
+  }
+
+  /// stopping half way must be noticed
+  compressed.resize(compressed.size() - 10);
+
+  auto truncated = Decompressor::create(compression);
+  got.clear();
+
+  if (!decompress_all(*truncated.get_value(), compressed, got) || truncated.get_value()->complete()) {
+    fprintf(stderr, "%s: truncated data not detected\n", name);
+    return false;
+  }
+
+  if (count_file(compressed)) {
+    fprintf(stderr, "%s: truncated file not detected\n", name);
+    return false;
+  }
+
+  return true;
+}
+
+int main() {
+  if (detect_compression(4, (const uint8_t*) "\x1f\x8b\x08\x00") != Compression::GZIP ||
+      detect_compression(4, (const uint8_t*) "\x28\xb5\x2f\xfd") != Compression::ZSTD ||
+      detect_compression(4, (const uint8_t*) "\x1f\x00\x08\x00") != Compression::NONE ||
+      detect_compression(1, (const uint8_t*) "\x1f") != Compression::NONE) {
+    fprintf(stderr, "wrong format detected\n");
+    return 1;
+  }
+
+#if BC_HAVE_ZLIB
+  if (!check_format(Compression::GZIP, gzip)) {
+    return 1;
+  }
+#endif
+
+#if BC_HAVE_LIBZSTD
+  if (!check_format(Compression::ZSTD, zstd)) {
+    return 1;
+  }
+#endif
+}
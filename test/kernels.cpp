@@ -0,0 +1,61 @@
+
+#include "bitcnt.hpp"
+#include <cstdio>  // for fprintf
+
+using namespace bc;
+
+int main() {
+  const size_t MAX_SIZE = 2 * 4096;
+  /// every misalignment a kernel could care about, up to a cache line
+  const size_t MAX_HEAD = 64;
+  /// a couple of chunks is plenty to get past a misaligned head
+  const size_t MAX_UNALIGNED_SIZE = 1024;
+
+  Bitcount_Buffer buffer = Bitcount_Buffer::allocate(MAX_SIZE + MAX_HEAD);
+
+  /// xorshift, any bit pattern will do
+  uint32_t state = 1;
+  for (size_t i = 0; i < MAX_SIZE + MAX_HEAD; i++) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    buffer.get()[i] = uint8_t(state);
+  }
+
+  /// reference that has nothing in common with the kernels: one bit at a time, one byte at a time
+  size_t ones_in_byte[256];
+  for (size_t byte = 0; byte < 256; byte++) {
+    ones_in_byte[byte] = 0;
+    for (size_t bit = 0; bit < 8; bit++) {
+      ones_in_byte[byte] += (byte >> bit) & 1;
+    }
+  }
+
+  for (Kernel kernel : ALL_KERNELS) {
+    if (!kernel_available(kernel)) {
+      continue;
+    }
+
+    for (size_t head = 0; head < MAX_HEAD; head++) {
+      const uint8_t *data = buffer.get() + head;
+
+      size_t want_ones = 0;
+
+      const size_t max_size = head == 0 ? MAX_SIZE : MAX_UNALIGNED_SIZE;
+
+      for (size_t size = 0; size <= max_size; size++) {
+        const Count cnt = bc::bitcount(size, data, kernel);
+
+        if (cnt.ones != want_ones || cnt.zeroes != 8 * size - want_ones) {
+          fprintf(stderr, "kernel %s, offset %zu, size %zu: expected %zu/%zu ones/zeroes, got %zu/%zu\n",
+                  kernel_name(kernel), head, size, want_ones, 8 * size - want_ones, cnt.ones, cnt.zeroes);
+          return 1;
+        }
+
+        if (size < max_size) {
+          want_ones += ones_in_byte[data[size]];
+        }
+      }
+    }
+  }
+}
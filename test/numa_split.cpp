@@ -0,0 +1,96 @@
+
+#include "bitcnt.hpp"
+#include "numa.hpp"
+#include "on_exit.hpp"
+#include "sys.hpp"
+#include <cstdio>  // for fprintf
+#include <cstdlib> // for getenv
+
+using namespace bc;
+
+int main() {
+  /// not a multiple of the block size, so the last block is partial
+  const size_t SIZE = 7 * 1024 * 1024 + 4096 + 64 + 3;
+  Bitcount_Buffer buffer = Bitcount_Buffer::allocate(SIZE);
+
+  uint32_t state = 1;
+  for (size_t i = 0; i < SIZE; i++) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    buffer.get()[i] = uint8_t(state);
+  }
+
+  const Count want = bc::bitcount(SIZE, buffer.get());
+
+  /// pretend there are more nodes than there are, blocks on unknown nodes must still be counted exactly once
+  for (const std::vector<int> &nodes : {std::vector<int>{0}, std::vector<int>{0, 1}, std::vector<int>{0, 1, 2}}) {
+    Numa numa;
+    numa.nodes = nodes;
+
+    const Count cnt = numa.bitcount(SIZE, buffer.get(), DEFAULT_KERNEL);
+
+    if (cnt.ones != want.ones || cnt.zeroes != want.zeroes) {
+      fprintf(stderr, "%zu nodes: expected %zu/%zu ones/zeroes, got %zu/%zu\n",
+              nodes.size(), want.ones, want.zeroes, cnt.ones, cnt.zeroes);
+      return 1;
+    }
+  }
+
+  /// *** residency: a fresh, lazily faulted file mapping must still be looked up where its pages live
+
+  const char *tmp = getenv("TMPDIR");
+
+  std::string path;
+  auto fd = sys::create_temp_file(tmp ? tmp : "/tmp", path);
+  if (!fd) {
+    fprintf(stderr, "could not create temp file: %s\n", fd.get_error().message().c_str());
+    return 1;
+  }
+  sys::unlink(path);
+  auto closer = on_exit([&]() { sys::close(*fd); });
+
+  if (!sys::write(*fd, SIZE, buffer.get())) {
+    fprintf(stderr, "could not write temp file\n");
+    return 1;
+  }
+
+  auto mapped = sys::mmap(*fd, SIZE);
+  if (!mapped) {
+    fprintf(stderr, "could not mmap temp file: %s\n", mapped.get_error().message().c_str());
+    return 1;
+  }
+  auto unmapper = on_exit([&]() { sys::munmap(*mapped, SIZE); });
+
+  const uint8_t *data = (const uint8_t*) *mapped;
+
+  /// where the buffer we filled above lives, or nothing if the kernel can't tell us (no libnuma, seccomp, ...)
+  const void *probe = buffer.get();
+  int         node  = -1;
+  const bool  known = bool(sys::numa_page_nodes(1, &probe, &node)) && node >= 0;
+
+  Numa numa;
+  numa.nodes = {known ? node : 0, known ? node + 1 : 1};
+
+  const std::vector<int> where = numa.block_nodes(SIZE, data);
+
+  if (where.size() != (SIZE + Numa::BLOCK_SIZE - 1) / Numa::BLOCK_SIZE) {
+    fprintf(stderr, "expected one node per block, got %zu\n", where.size());
+    return 1;
+  }
+
+  /// on a single node machine everything is on that node, once it's faulted in
+  for (size_t i = 0; i < where.size(); i++) {
+    if (known ? where[i] < 0 : where[i] != -1) {
+      fprintf(stderr, "block %zu: unexpected node %d (kernel %s tell us)\n", i, where[i], known ? "can" : "can't");
+      return 1;
+    }
+  }
+
+  const Count cnt = numa.bitcount(SIZE, data, DEFAULT_KERNEL);
+
+  if (cnt.ones != want.ones || cnt.zeroes != want.zeroes) {
+    fprintf(stderr, "mapped: expected %zu/%zu ones/zeroes, got %zu/%zu\n", want.ones, want.zeroes, cnt.ones, cnt.zeroes);
+    return 1;
+  }
+}
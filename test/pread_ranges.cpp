@@ -0,0 +1,74 @@
+
+#include "bitcnt.hpp"
+#include "file_bit_counter.hpp"
+#include "sys.hpp"
+#include <cstdio>  // for fprintf
+#include <cstdlib> // for getenv
+#include <limits>  // for std::numeric_limits
+
+using namespace bc;
+
+int main() {
+  /// a couple of pread ranges plus a partial one at the end
+  const size_t SIZE = 5 * 1024 * 1024 + 12345;
+  Bitcount_Buffer buffer = Bitcount_Buffer::allocate(SIZE);
+
+  uint32_t state = 1;
+  for (size_t i = 0; i < SIZE; i++) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    buffer.get()[i] = uint8_t(state);
+  }
+
+  const char *tmp = getenv("TMPDIR");
+
+  std::string path;
+  auto fd = sys::create_temp_file(tmp ? tmp : "/tmp", path);
+  if (!fd) {
+    fprintf(stderr, "could not create temp file: %s\n", fd.get_error().message().c_str());
+    return 1;
+  }
+  sys::unlink(path);
+
+  if (!sys::write(*fd, SIZE, buffer.get())) {
+    fprintf(stderr, "could not write temp file\n");
+    return 1;
+  }
+
+  /// never mmap, so big files go through pread
+  Tuning tuning = Tuning::defaults(4096);
+  tuning.mmap_threshold = std::numeric_limits<size_t>::max();
+
+  const File_Bit_Counter files{tuning};
+
+  /// counting starts at the file position, like read() would, and leaves it at the end
+  for (size_t position : {size_t(0), size_t(12345), SIZE}) {
+    if (!sys::seek(*fd, position)) {
+      fprintf(stderr, "could not seek temp file\n");
+      return 1;
+    }
+
+    const Count want = bc::bitcount(SIZE - position, buffer.get() + position);
+
+    auto cnt = files.bitcount(*fd, path);
+    if (!cnt) {
+      fprintf(stderr, "error: %s\n", cnt.get_error().message().c_str());
+      return 1;
+    }
+
+    if (cnt->ones != want.ones || cnt->zeroes != want.zeroes) {
+      fprintf(stderr, "from %zu: expected %zu/%zu ones/zeroes, got %zu/%zu\n",
+              position, want.ones, want.zeroes, cnt->ones, cnt->zeroes);
+      return 1;
+    }
+
+    auto end = sys::tell(*fd);
+    if (!end || *end != SIZE) {
+      fprintf(stderr, "from %zu: expected to end up at %zu\n", position, SIZE);
+      return 1;
+    }
+  }
+
+  sys::close(*fd);
+}
@@ -0,0 +1,115 @@
+
+#include "bitcnt.hpp"
+#include "progress.hpp"
+#include <chrono>      // for std::chrono::steady_clock, std::chrono::milliseconds
+#include <csignal>     // for raise, SIGINT
+#include <cstdio>      // for fprintf, tmpfile, fread
+#include <string>      // for std::string
+#include <sys/wait.h>  // for waitpid, WIFEXITED, WEXITSTATUS
+#include <thread>      // for std::this_thread::sleep_for
+#include <unistd.h>    // for fork
+
+using namespace bc;
+
+static std::string read_all(FILE *file) {
+  std::string content;
+  char        buf[4096];
+
+  fflush(file);
+  rewind(file);
+
+  size_t got;
+  while ((got = fread(buf, 1, sizeof(buf), file)) > 0) {
+    content.append(buf, got);
+  }
+  return content;
+}
+
+int main() {
+  Count cnt;
+  cnt.ones   = 3000;
+  cnt.zeroes = 5000;
+
+  /// *** interrupted: the partial count is handed out and we exit, in a child so we survive it
+
+  FILE *interrupted = tmpfile();
+  if (!interrupted) {
+    fprintf(stderr, "could not create temp file\n");
+    return 1;
+  }
+
+  const pid_t child = fork();
+  if (child == 0) {
+    Progress progress{2000};
+    progress.add(cnt);
+
+    Progress_Reporter reporter{progress, interrupted, 0, [&](Count partial) {
+      fprintf(interrupted, "partial %zu %zu\n", partial.ones, partial.zeroes);
+      fflush(interrupted);
+    }};
+
+    raise(SIGINT);
+
+    std::this_thread::sleep_for(std::chrono::seconds(10));
+    _exit(0);
+  }
+
+  int status = 0;
+  if (child == -1 || waitpid(child, &status, 0) != child) {
+    fprintf(stderr, "could not run child\n");
+    return 1;
+  }
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 130) {
+    fprintf(stderr, "expected the interrupted child to exit with 130, status %d\n", status);
+    return 1;
+  }
+
+  const std::string partial = read_all(interrupted);
+
+  if (partial.find("progress: 1.0 kB of 2.0 kB (50.0%)") == std::string::npos ||
+      partial.find("3000 ones, 5000 zeroes") == std::string::npos ||
+      partial.find("partial 3000 5000\n") == std::string::npos) {
+    fprintf(stderr, "unexpected output on interrupt:\n%s", partial.c_str());
+    return 1;
+  }
+
+  /// *** periodic reports show the running counts, and stopping doesn't wait for the next poll
+
+  FILE *periodic = tmpfile();
+  if (!periodic) {
+    fprintf(stderr, "could not create temp file\n");
+    return 1;
+  }
+
+  {
+    Progress progress{1000};
+    progress.add(cnt);
+
+    std::chrono::steady_clock::time_point stopping;
+    {
+      Progress_Reporter reporter{progress, periodic, 0.01, nullptr};
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(250));
+      stopping = std::chrono::steady_clock::now();
+    }
+    const auto stopped = std::chrono::steady_clock::now();
+
+    if (stopped - stopping > std::chrono::milliseconds(50)) {
+      fprintf(stderr, "stopping the reporter took %.0f ms\n",
+              std::chrono::duration<double, std::milli>(stopped - stopping).count());
+      return 1;
+    }
+  }
+
+  const std::string reports = read_all(periodic);
+
+  if (reports.find("progress: 1.0 kB of 1.0 kB (100.0%)") == std::string::npos ||
+      reports.find("3000 ones, 5000 zeroes (37.500% ones)") == std::string::npos) {
+    fprintf(stderr, "unexpected progress reports:\n%s", reports.c_str());
+    return 1;
+  }
+
+  fclose(periodic);
+  fclose(interrupted);
+}
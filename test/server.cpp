@@ -0,0 +1,145 @@
+
+#include "bitcnt.hpp"
+#include "file_bit_counter.hpp"
+#include "on_exit.hpp"
+#include "server.hpp"
+#include "sys.hpp"
+#include <chrono>     // for std::chrono::milliseconds
+#include <cstdio>     // for fprintf
+#include <cstdlib>    // for getenv
+#include <sys/stat.h> // for mkfifo
+#include <thread>     // for std::thread, std::this_thread::sleep_for
+#include <unistd.h>   // for pipe
+
+using namespace bc;
+
+int main() {
+  const size_t SIZE = 1024 * 1024 + 123;
+  Bitcount_Buffer buffer = Bitcount_Buffer::allocate(SIZE);
+
+  uint32_t state = 1;
+  for (size_t i = 0; i < SIZE; i++) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    buffer.get()[i] = uint8_t(state);
+  }
+
+  const char *tmp = getenv("TMPDIR");
+
+  std::string path;
+  auto fd = sys::create_temp_file(tmp ? tmp : "/tmp", path);
+  if (!fd) {
+    fprintf(stderr, "could not create temp file: %s\n", fd.get_error().message().c_str());
+    return 1;
+  }
+  auto remover = on_exit([&]() { sys::unlink(path); });
+
+  if (!sys::write(*fd, SIZE, buffer.get())) {
+    fprintf(stderr, "could not write temp file\n");
+    return 1;
+  }
+
+  const Count want = bc::bitcount(SIZE, buffer.get());
+
+  const std::string socket_path = path + ".sock";
+  auto socket_remover = on_exit([&]() { sys::unlink(socket_path); });
+
+  /// the server never returns, so it must not use anything that goes away when main() does
+  const File_Bit_Counter *files = new File_Bit_Counter{Tuning::defaults(4096)};
+
+  std::thread{[&socket_path, files]() {
+    auto served = serve(socket_path, *files);
+    fprintf(stderr, "server stopped: %s\n", served ? "no error" : served.get_error().message().c_str());
+  }}.detach();
+
+  /// a client that sends half a header and then nothing must not hold up anybody else
+  auto stalled = sys::connect_unix(socket_path);
+  for (int i = 0; !stalled && i < 100; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    stalled = sys::connect_unix(socket_path);
+  }
+  if (!stalled) {
+    fprintf(stderr, "could not connect to server: %s\n", stalled.get_error().message().c_str());
+    return 1;
+  }
+
+  const uint8_t half_header[4] = {};
+  if (!sys::send(*stalled, sizeof(half_header), half_header, {})) {
+    fprintf(stderr, "could not send half a header\n");
+    return 1;
+  }
+
+  auto client = Bitcount_Client::connect(socket_path);
+  if (!client) {
+    fprintf(stderr, "error: %s\n", client.get_error().message().c_str());
+    return 1;
+  }
+
+  auto passed = sys::open(path);
+  if (!passed) {
+    fprintf(stderr, "could not open temp file: %s\n", passed.get_error().message().c_str());
+    return 1;
+  }
+
+  /// neither has a writer that ever finishes, counting them would hang the server
+  const std::string fifo_path = path + ".fifo";
+  if (mkfifo(fifo_path.c_str(), 0600) != 0) {
+    fprintf(stderr, "could not create fifo\n");
+    return 1;
+  }
+  auto fifo_remover = on_exit([&]() { sys::unlink(fifo_path); });
+
+  int pipe_fds[2];
+  if (pipe(pipe_fds) != 0) {
+    fprintf(stderr, "could not create pipe\n");
+    return 1;
+  }
+
+  const std::vector<Bitcount_Request> batch = {
+    Bitcount_Request::for_path(path),
+    Bitcount_Request::for_fd(*passed, "passed"),
+    Bitcount_Request::for_path(path + ".does-not-exist"),
+    Bitcount_Request::for_path(fifo_path),
+    Bitcount_Request::for_fd(pipe_fds[0], "pipe"),
+  };
+
+  auto results = client->bitcount(batch);
+  if (!results) {
+    fprintf(stderr, "error: %s\n", results.get_error().message().c_str());
+    return 1;
+  }
+
+  if (results->size() != batch.size()) {
+    fprintf(stderr, "expected %zu results, got %zu\n", batch.size(), results->size());
+    return 1;
+  }
+
+  const Result<Count, Error> &by_path = (*results)[0];
+  if (!by_path || by_path->ones != want.ones || by_path->zeroes != want.zeroes) {
+    fprintf(stderr, "wrong count for path: %s\n", by_path ? "different bits" : by_path.get_error().message().c_str());
+    return 1;
+  }
+
+  const Result<Count, Error> &by_fd = (*results)[1];
+  if (!by_fd || by_fd->ones != want.ones || by_fd->zeroes != want.zeroes) {
+    fprintf(stderr, "wrong count for passed fd: %s\n", by_fd ? "different bits" : by_fd.get_error().message().c_str());
+    return 1;
+  }
+
+  if ((*results)[2]) {
+    fprintf(stderr, "expected an error for a missing file\n");
+    return 1;
+  }
+
+  if ((*results)[3] || (*results)[4]) {
+    fprintf(stderr, "expected errors for a fifo and a pipe\n");
+    return 1;
+  }
+
+  sys::close(pipe_fds[0]);
+  sys::close(pipe_fds[1]);
+  sys::close(*stalled);
+  sys::close(*passed);
+  sys::close(*fd);
+}
@@ -0,0 +1,154 @@
+
+#include "file_bit_counter.hpp"
+#include "sys.hpp"
+#include "tar.hpp"
+#include <algorithm> // for std::min
+#include <cstdio>    // for fprintf, snprintf
+#include <cstring>   // for memcpy, memset
+#include <string>    // for std::string
+#include <unistd.h>  // for pipe
+#include <vector>    // for std::vector
+
+using namespace bc;
+
+/// append a header & padded payload to an archive
+static void add_entry(std::vector<uint8_t> &tar, char type, const std::string &name, const std::string &payload,
+                      const std::string &prefix = "") {
+  uint8_t header[TAR_BLOCK_SIZE];
+  memset(header, 0, sizeof(header));
+
+  memcpy(header, name.data(), std::min(name.size(), size_t(100)));
+  snprintf((char*) header + 124, 12, "%011o", unsigned(payload.size()));
+  header[156] = uint8_t(type);
+  memcpy(header + 257, "ustar\0" "00", 8);
+  memcpy(header + 345, prefix.data(), prefix.size());
+
+  unsigned sum = 0;
+  memset(header + 148, ' ', 8);
+  for (uint8_t byte : header) {
+    sum += byte;
+  }
+  snprintf((char*) header + 148, 8, "%06o", sum);
+
+  tar.insert(tar.end(), header, header + sizeof(header));
+  tar.insert(tar.end(), payload.begin(), payload.end());
+  tar.resize(tar_padded_size(tar.size()), 0);
+}
+
+/// count an archive streamed through a pipe, which can't be mapped
+static Result<std::vector<Tar_Count>, Error> stream_members(const std::vector<uint8_t> &tar) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return Error{std::make_error_code(std::errc::io_error), "could not create pipe"};
+  }
+
+  /// small enough to fit into the pipe buffer, so we don't need another thread to write
+  auto written = sys::write(fds[1], tar.size(), tar.data());
+  sys::close(fds[1]);
+
+  if (!written) {
+    sys::close(fds[0]);
+    return Error{written, "could not write to pipe"};
+  }
+
+  const File_Bit_Counter files{4096};
+
+  auto members = files.bitcount_tar(fds[0], "<pipe>");
+  sys::close(fds[0]);
+  return members;
+}
+
+static std::string pax_record(const std::string &key, const std::string &value) {
+  /// the length includes itself, which is why this is a bit roundabout
+  const std::string rest = " " + key + "=" + value + "\n";
+
+  size_t len = rest.size() + 1;
+  while (std::to_string(len).size() + rest.size() != len) {
+    len++;
+  }
+  return std::to_string(len) + rest;
+}
+
+int main() {
+  const std::string long_name(300, 'x');
+
+  std::vector<uint8_t> tar;
+  add_entry(tar, '0', "plain", "hello");
+  add_entry(tar, '5', "dir/", "");
+  add_entry(tar, '0', "name", std::string(1000, 'a'), "prefix");
+  add_entry(tar, 'L', "././@LongLink", long_name + '\0');
+  add_entry(tar, '0', "truncated-name", "b");
+  add_entry(tar, 'x', "pax", pax_record("path", "pax/name"));
+  add_entry(tar, '0', "ignored", "");
+  tar.resize(tar.size() + 2 * TAR_BLOCK_SIZE, 0);
+
+  struct Want {
+    std::string name;
+    size_t      size;
+  };
+  const std::vector<Want> want = {
+    {"plain", 5},
+    {"prefix/name", 1000},
+    {long_name, 1},
+    {"pax/name", 0},
+  };
+
+  auto members = tar_members(tar.size(), tar.data());
+  if (!members) {
+    fprintf(stderr, "error: %s\n", members.get_error().msg.c_str());
+    return 1;
+  }
+
+  if (members->size() != want.size()) {
+    fprintf(stderr, "expected %zu members, got %zu\n", want.size(), members->size());
+    return 1;
+  }
+
+  for (size_t i = 0; i < want.size(); i++) {
+    const Tar_Member &m = (*members)[i];
+
+    if (m.name != want[i].name || m.size != want[i].size || m.offset % TAR_BLOCK_SIZE != 0) {
+      fprintf(stderr, "member %zu: expected %s (%zu bytes), got %s (%zu bytes at %zu)\n",
+              i, want[i].name.c_str(), want[i].size, m.name.c_str(), m.size, m.offset);
+      return 1;
+    }
+  }
+
+  /// payloads must point at the right data
+  if (memcmp(tar.data() + (*members)[0].offset, "hello", 5) != 0) {
+    fprintf(stderr, "wrong offset for first member\n");
+    return 1;
+  }
+
+  /// broken checksums must be caught
+  tar[148] ^= 1;
+  if (tar_members(tar.size(), tar.data())) {
+    fprintf(stderr, "expected checksum error\n");
+    return 1;
+  }
+
+  /// streamed: the payload of every member ends with padding, archives that stop in there are truncated
+  std::vector<uint8_t> streamed;
+  add_entry(streamed, '0', "plain", "hello");
+
+  const Count hello = bitcount(5, (const uint8_t*) "hello");
+
+  auto counted = stream_members(streamed);
+  if (!counted || counted->size() != 1 || counted->front().name != "plain" ||
+      counted->front().count.ones != hello.ones || counted->front().count.zeroes != hello.zeroes) {
+    fprintf(stderr, "streamed: expected one member with the bits of \"hello\", got %s\n",
+            counted ? std::to_string(counted->size()).c_str() : counted.get_error().message().c_str());
+    return 1;
+  }
+
+  streamed.resize(TAR_BLOCK_SIZE + 5 + 1);
+  if (stream_members(streamed)) {
+    fprintf(stderr, "streamed: expected truncation in the padding to be an error\n");
+    return 1;
+  }
+
+  if (tar_members(streamed.size(), streamed.data())) {
+    fprintf(stderr, "mapped: expected truncation in the padding to be an error\n");
+    return 1;
+  }
+}